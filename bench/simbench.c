@@ -0,0 +1,312 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Cycle benchmark harness: runs a firmware built with -DBENCH in simavr
+// and times the regions marked with BENCH_BEGIN/BENCH_END (see
+// include/bench.h), plus the latency from each Timer1 compare match to
+// the entry of its ISR. Writes a JSON report and checks it against the
+// budgets file, exiting non-zero if any budget is exceeded.
+//
+//     simbench [-f hz] [-m ms] [-p port=levels]... [-b budgets -n name]
+//              [-o report.json] [-r measured] firmware.elf
+//
+//  -f  CPU clock, as F_CPU in the Makefile (a UL suffix is fine)
+//  -m  simulated ms to run
+//  -p  levels driven onto the input pins of a port, e.g. D=0xff for
+//      released buttons, since simavr has no board around the chip
+//  -b  budgets file, lines of: firmware marker metric limit
+//  -n  firmware name the budgets are looked up by
+//  -r  file to write the measured max of every marker seen to, in the
+//      budgets format, as the starting point for setting the budgets
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_irq.h"
+#include "avr_ioport.h"
+#include "avr_timer.h"
+
+#define BENCH_HOST
+#include "bench.h"
+
+#define BENCH_GPIOR0  0x3E	// Data space address of GPIOR0
+#define BENCH_IDS     128
+#define BENCH_DEPTH   8		// Nested begins of the same marker
+#define BENCH_LATENCY BENCH_IDS	// Slot of the ISR latency figures
+
+typedef struct bench_stat {
+	const char *name;
+	unsigned long count;
+	uint64_t total, min, max;
+	uint64_t start[BENCH_DEPTH];
+	uint8_t depth;
+} bench_stat;
+
+static bench_stat bench_stats[BENCH_IDS + 1];
+static uint64_t bench_match;		// Cycle of the pending compare match, 0 if none
+static unsigned long bench_unmatched;	// Ends without a begin
+
+static void bench_record(bench_stat *s, uint64_t cycles) {
+	if (!s->count || cycles < s->min) {
+		s->min = cycles;
+	}
+	if (cycles > s->max) {
+		s->max = cycles;
+	}
+	s->total += cycles;
+	s->count++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// simavr callbacks
+
+static void bench_marker(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+	bench_stat *s = &bench_stats[v & ~BENCH_END_BIT];
+	(void)param;
+	avr->data[addr] = v;
+	if (!(v & BENCH_END_BIT)) {
+		if ((v == BENCH_TIMER_ISR) && bench_match) {
+			bench_record(&bench_stats[BENCH_LATENCY], avr->cycle - bench_match);
+			bench_match = 0;
+		}
+		if (s->depth < BENCH_DEPTH) {
+			s->start[s->depth] = avr->cycle;
+		}
+		s->depth++;
+	}
+	else if (!s->depth) {
+		bench_unmatched++;
+	}
+	else if (--s->depth < BENCH_DEPTH) {
+		bench_record(s, avr->cycle - s->start[s->depth]);
+	}
+}
+
+static void bench_compare(struct avr_irq_t *irq, uint32_t value, void *param) {
+	avr_t *avr = param;
+	(void)irq; (void)value;
+	if (!bench_match) {
+		bench_match = avr->cycle;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Budgets
+
+// Value of metric for stat s, or -1 if the metric is unknown
+static double bench_metric(const bench_stat *s, const char *metric) {
+	if (!strcmp(metric, "max")) {
+		return s->max;
+	}
+	if (!strcmp(metric, "avg")) {
+		return s->count ? (double)s->total / s->count : 0;
+	}
+	if (!strcmp(metric, "count")) {
+		return s->count;
+	}
+	return -1;
+}
+
+static const bench_stat *bench_find(const char *name) {
+	int i;
+	for (i = 0; i <= BENCH_IDS; i++) {
+		if (bench_stats[i].name && !strcmp(bench_stats[i].name, name)) {
+			return &bench_stats[i];
+		}
+	}
+	return 0;
+}
+
+// Checks every budget of firmware, writing the results into the report.
+// Returns the number exceeded, or -1 if the file is unusable.
+static int bench_budgets(const char *path, const char *firmware, FILE *report) {
+	char line[256], fw[64], marker[64], metric[16];
+	double limit, value;
+	const bench_stat *s;
+	int over = 0, first = 1;
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "simbench: can't read %s\n", path);
+		return -1;
+	}
+	fprintf(report, ",\n  \"budgets\": [");
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%63s %63s %15s %lf", fw, marker, metric, &limit) != 4 ||
+				strcmp(fw, firmware)) {
+			continue;
+		}
+		s = bench_find(marker);
+		value = s ? bench_metric(s, metric) : -1;
+		if (value < 0) {
+			fprintf(stderr, "simbench: unknown budget %s %s\n", marker, metric);
+			over++;
+			continue;
+		}
+		fprintf(report, "%s\n    {\"marker\": \"%s\", \"metric\": \"%s\", \"limit\": %.0f, "
+			"\"value\": %.0f, \"ok\": %s}", first ? "" : ",", marker, metric, limit, value,
+			value <= limit ? "true" : "false");
+		first = 0;
+		if (value > limit) {
+			fprintf(stderr, "simbench: %s %s %s is %.0f cycles, over the budget of %.0f\n",
+				firmware, marker, metric, value, limit);
+			over++;
+		}
+	}
+	fprintf(report, "\n  ]");
+	fclose(f);
+	return over;
+}
+
+// Writes one budgets line per marker that ran, with its measured max
+static int bench_measured(const char *path, const char *firmware, unsigned long hz) {
+	int i;
+	const bench_stat *s;
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "simbench: can't write %s\n", path);
+		return -1;
+	}
+	fprintf(f, "# Measured by simbench at %lu Hz, without headroom\n", hz);
+	for (i = 0; i <= BENCH_IDS; i++) {
+		s = &bench_stats[i];
+		if (s->name && s->count) {
+			fprintf(f, "%-7s %-18s max  %llu\n", firmware, s->name,
+				(unsigned long long)s->max);
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void bench_report(FILE *out, const char *firmware, const char *elf,
+		unsigned long hz, uint64_t cycles) {
+	int i, first = 1;
+	const bench_stat *s;
+	fprintf(out, "{\n  \"firmware\": \"%s\",\n  \"elf\": \"%s\",\n", firmware, elf);
+	fprintf(out, "  \"f_cpu\": %lu,\n  \"cycles\": %llu,\n  \"unmatched_ends\": %lu,\n",
+		hz, (unsigned long long)cycles, bench_unmatched);
+	fprintf(out, "  \"markers\": [");
+	for (i = 0; i <= BENCH_IDS; i++) {
+		s = &bench_stats[i];
+		if (!s->name) {
+			continue;
+		}
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"count\": %lu, \"min\": %llu, "
+			"\"avg\": %.1f, \"max\": %llu, \"max_us\": %.1f}", first ? "" : ",",
+			s->name, s->count, (unsigned long long)s->min,
+			s->count ? (double)s->total / s->count : 0.0,
+			(unsigned long long)s->max, s->max * 1e6 / hz);
+		first = 0;
+	}
+	fprintf(out, "\n  ]");
+}
+
+int main(int argc, char *argv[]) {
+	elf_firmware_t fw;
+	avr_t *avr;
+	avr_irq_t *irq;
+	unsigned long hz = 8000000, ms = 10000;
+	const char *budgets = 0, *name = "firmware", *out_path = 0, *measured = 0;
+	char port;
+	unsigned int levels;
+	char ports[8];
+	unsigned int port_levels[8];
+	int nports = 0, opt, state, over = 0, i;
+	uint64_t end;
+	FILE *out = stdout;
+
+	while ((opt = getopt(argc, argv, "f:m:p:b:n:o:r:")) != -1) {
+		switch (opt) {
+			case 'f': hz = strtoul(optarg, 0, 0); break;
+			case 'm': ms = strtoul(optarg, 0, 0); break;
+			case 'b': budgets = optarg; break;
+			case 'n': name = optarg; break;
+			case 'o': out_path = optarg; break;
+			case 'r': measured = optarg; break;
+			case 'p':
+				if (nports < 8 && sscanf(optarg, "%c=%i", &port, &levels) == 2) {
+					ports[nports] = port;
+					port_levels[nports++] = levels;
+					break;
+				}
+				// fall through
+			default:
+				fprintf(stderr, "usage: %s [-f hz] [-m ms] [-p port=levels] "
+					"[-b budgets -n name] [-o report.json] [-r measured] firmware.elf\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "simbench: no firmware given\n");
+		return 2;
+	}
+
+#define BENCH_NAME(n, id) bench_stats[id].name = #n;
+	BENCH_MARKERS(BENCH_NAME)
+#undef BENCH_NAME
+	bench_stats[BENCH_LATENCY].name = "TIMER_ISR_LATENCY";
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[optind], &fw)) {
+		fprintf(stderr, "simbench: can't load %s\n", argv[optind]);
+		return 2;
+	}
+	avr = avr_make_mcu_by_name(fw.mmcu[0] ? fw.mmcu : "atmega1284p");
+	if (!avr) {
+		fprintf(stderr, "simbench: no simavr core for %s\n", fw.mmcu);
+		return 2;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = hz;
+	avr->log = LOG_WARNING;
+
+	avr_register_io_write(avr, BENCH_GPIOR0, bench_marker, 0);
+	irq = avr_io_getirq(avr, AVR_IOCTL_TIMER_GETIRQ('1'), TIMER_IRQ_OUT_COMP + AVR_TIMER_COMPA);
+	if (irq) {
+		avr_irq_register_notify(irq, bench_compare, avr);
+	}
+	for (i = 0; i < nports; i++) {
+		irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ports[i]), IOPORT_IRQ_PIN_ALL);
+		if (irq) {
+			avr_raise_irq(irq, port_levels[i]);
+		}
+	}
+
+	end = (uint64_t)ms * (hz / 1000);
+	state = cpu_Running;
+	while (state != cpu_Done && state != cpu_Crashed && avr->cycle < end) {
+		state = avr_run(avr);
+	}
+	if (state == cpu_Crashed) {
+		fprintf(stderr, "simbench: %s crashed at cycle %llu\n", name,
+			(unsigned long long)avr->cycle);
+		over++;
+	}
+
+	if (out_path && !(out = fopen(out_path, "w"))) {
+		fprintf(stderr, "simbench: can't write %s\n", out_path);
+		return 2;
+	}
+	bench_report(out, name, argv[optind], hz, avr->cycle);
+	if (budgets) {
+		i = bench_budgets(budgets, name, out);
+		over = i < 0 ? over + 1 : over + i;
+	}
+	if (measured && bench_measured(measured, name, hz)) {
+		over++;
+	}
+	fprintf(out, ",\n  \"ok\": %s\n}\n", over ? "false" : "true");
+	if (out != stdout) {
+		fclose(out);
+	}
+	return over ? 1 : 0;
+}
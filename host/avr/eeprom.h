@@ -0,0 +1,24 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+// Host stand-in for <avr/eeprom.h>. EEMEM variables are ordinary
+// memory, so contents start from their initializers on every run and
+// only last across a simulated watchdog reset, see sim.h.
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM __attribute__((section("sim_eeprom")))
+
+#define eeprom_read_block(dst, src, n)   memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
+#define eeprom_write_block(src, dst, n)  memcpy((dst), (src), (n))
+#define eeprom_read_byte(p)        (*(const uint8_t *)(p))
+#define eeprom_update_byte(p, v)   (*(uint8_t *)(p) = (v))
+#define eeprom_read_word(p)        (*(const uint16_t *)(p))
+#define eeprom_update_word(p, v)   (*(uint16_t *)(p) = (v))
+
+#endif
@@ -0,0 +1,18 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+// Host stand-in for <avr/interrupt.h>. Vectors are plain functions the
+// simulator calls by name when their flag and enable bit are set.
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define ISR_NOBLOCK
+#define EMPTY_INTERRUPT(vector) void vector(void) {}
+#define sei() (SREG |= (1 << SREG_I))
+#define cli() (SREG &= ~(1 << SREG_I))
+
+#endif
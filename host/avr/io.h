@@ -0,0 +1,130 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Host stand-in for avr-libc's <avr/io.h>, see sim.h. Every register
+// name expands to an access through sim_io8()/sim_io16(), which first
+// moves simulated time on and runs due interrupts, so busy waits on a
+// register make progress. Only the ATmega1284P registers and bits the
+// firmwares use are here.
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define PORTA   SIM_R8(SIM_PORTA)
+#define PINA    SIM_R8(SIM_PINA)
+#define DDRA    SIM_R8(SIM_DDRA)
+#define PORTB   SIM_R8(SIM_PORTB)
+#define PINB    SIM_R8(SIM_PINB)
+#define DDRB    SIM_R8(SIM_DDRB)
+#define PORTC   SIM_R8(SIM_PORTC)
+#define PINC    SIM_R8(SIM_PINC)
+#define DDRC    SIM_R8(SIM_DDRC)
+#define PORTD   SIM_R8(SIM_PORTD)
+#define PIND    SIM_R8(SIM_PIND)
+#define DDRD    SIM_R8(SIM_DDRD)
+#define ADCSRA  SIM_R8(SIM_ADCSRA)
+#define ADCSRB  SIM_R8(SIM_ADCSRB)
+#define ADMUX   SIM_R8(SIM_ADMUX)
+#define DIDR0   SIM_R8(SIM_DIDR0)
+#define SREG    SIM_R8(SIM_SREG)
+#define TCCR1A  SIM_R8(SIM_TCCR1A)
+#define TCCR1B  SIM_R8(SIM_TCCR1B)
+#define TIMSK1  SIM_R8(SIM_TIMSK1)
+#define TIFR1   SIM_R8(SIM_TIFR1)
+#define TCCR3A  SIM_R8(SIM_TCCR3A)
+#define TCCR3B  SIM_R8(SIM_TCCR3B)
+#define TIMSK3  SIM_R8(SIM_TIMSK3)
+#define TIFR3   SIM_R8(SIM_TIFR3)
+#define MCUSR   SIM_R8(SIM_MCUSR)
+#define SMCR    SIM_R8(SIM_SMCR)
+#define GPIOR0  SIM_R8(SIM_GPIOR0)
+#define GPIOR1  SIM_R8(SIM_GPIOR1)
+#define GPIOR2  SIM_R8(SIM_GPIOR2)
+#define UCSR1A  SIM_R8(SIM_UCSR1A)
+#define UCSR1B  SIM_R8(SIM_UCSR1B)
+#define UCSR1C  SIM_R8(SIM_UCSR1C)
+#define WDTCSR  SIM_R8(SIM_WDTCSR)
+#define ADC     SIM_R16(SIM_ADC)
+#define OCR1A   SIM_R16(SIM_OCR1A)
+#define TCNT1   SIM_R16(SIM_TCNT1)
+#define TCNT3   SIM_R16(SIM_TCNT3)
+#define UBRR1   SIM_R16(SIM_UBRR1)
+#define UDR1    SIM_R16(SIM_UDR1)
+
+/* ADCSRA */
+#define ADEN    7
+#define ADSC    6
+#define ADATE   5
+#define ADIF    4
+#define ADIE    3
+#define ADPS2   2
+#define ADPS1   1
+#define ADPS0   0
+/* ADMUX */
+#define REFS1   7
+#define REFS0   6
+#define MUX0    0
+/* TCCR1B, TCCR3B */
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+#define CS32    2
+#define CS31    1
+#define CS30    0
+/* TIMSK1, TIFR1, TIMSK3, TIFR3 */
+#define OCIE1A  1
+#define OCF1A   1
+#define TOIE3   0
+#define TOV3    0
+/* UCSR1A */
+#define RXC1    7
+#define TXC1    6
+#define UDRE1   5
+#define FE1     4
+#define DOR1    3
+#define U2X1    1
+#define MPCM1   0
+/* UCSR1B */
+#define RXCIE1  7
+#define TXCIE1  6
+#define UDRIE1  5
+#define RXEN1   4
+#define TXEN1   3
+/* UCSR1C */
+#define UCSZ11  2
+#define UCSZ10  1
+/* MCUSR */
+#define JTRF    4
+#define WDRF    3
+#define BORF    2
+#define EXTRF   1
+#define PORF    0
+/* WDTCSR */
+#define WDIF    7
+#define WDIE    6
+#define WDP3    5
+#define WDCE    4
+#define WDE     3
+#define WDP2    2
+#define WDP1    1
+#define WDP0    0
+/* SREG */
+#define SREG_I  7
+/* Port bits */
+#define PB0     0
+#define PB1     1
+#define PB2     2
+
+#define RAMEND  0x40FF
+#define E2END   0xFFF
+
+/* avr-libc's stdlib extension, provided by sim.c */
+char *itoa(int value, char *s, int radix);
+
+#endif
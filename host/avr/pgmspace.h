@@ -0,0 +1,21 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+// Host stand-in for <avr/pgmspace.h>, flash is ordinary memory
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(a)  (*(const uint8_t *)(a))
+#define pgm_read_word(a)  (*(const uint16_t *)(a))
+#define pgm_read_dword(a) (*(const uint32_t *)(a))
+#define pgm_read_ptr(a)   (*(void * const *)(a))
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+
+#endif
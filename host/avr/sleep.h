@@ -0,0 +1,18 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+// Host stand-in for <avr/sleep.h>. Sleeping jumps simulated time to the
+// next timer or ADC event.
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(mode) ((void)(mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() sim_sleep()
+
+#endif
@@ -0,0 +1,30 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+// Host stand-in for <avr/wdt.h>, see sim.h. The timed WDCE sequence
+// isn't checked, WDTCSR simply takes the value written last.
+
+#ifndef SIM_AVR_WDT_H
+#define SIM_AVR_WDT_H
+
+#include <avr/io.h>
+
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+#define WDTO_8S 9
+
+#define wdt_reset() sim_wdr()
+#define wdt_enable(value) \
+	(WDTCSR = (1 << WDCE) | (1 << WDE), \
+	 WDTCSR = (1 << WDE) | ((value) & 0x08 ? 1 << WDP3 : 0) | ((value) & 0x07))
+#define wdt_disable() \
+	(WDTCSR = (1 << WDCE) | (1 << WDE), WDTCSR = 0)
+
+#endif
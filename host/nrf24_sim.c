@@ -0,0 +1,642 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Simulated nRF24L01 for the host build, driven by the unmodified
+// nrf24.c through the pins named in the firmware's nrf_pins.h.
+//
+// The model decodes the bit-banged SPI on CSN/SCK/MOSI/MISO and keeps
+// the register map, the 3 deep TX and RX FIFOs, the six pipes with
+// their addresses and static payload widths, auto-ack with packet ids
+// and duplicate rejection, and auto-retransmit with ARD/ARC and
+// OBSERVE_TX. Air time follows the address width, payload, CRC length
+// and data rate. Not modelled: dynamic payloads, ack payloads, the IRQ
+// pin and RPD.
+//
+// Frames travel as datagrams between every process using the same
+// SIM_NRF_AIR directory, each of which binds a socket there named after
+// its pid. An ack has to make it back within ARD of simulated time, so
+// the model paces the simulation to the wall clock (SIM_SPEED=1) unless
+// told otherwise. Options, from the environment:
+//  SIM_NRF_AIR      directory of the shared air, /tmp/nrf24-air by default
+//  SIM_NRF_LOSS     percent of frames lost on the way in, acks included
+//  SIM_NRF_LATENCY  extra us before a frame arrives
+//  SIM_NRF_JAM      period,length in ms: nothing gets through during
+//                   the first length ms of every period
+//  SIM_NRF_SEED     seed for the losses, 1 by default
+//
+// At exit it reports payloads sent, delivered, lost after the last
+// retry and cut short by the firmware, retransmits,
+// frames dropped on the air and in a full RX FIFO, throughput and the
+// time from CE starting a transmission to TX_DS or MAX_RT.
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <avr/io.h>
+#include "nRF24L01.h"
+#include "nrf_pins.h"
+#include "nrf24_sim.h"
+
+// Port and bit of a pin.h descriptor
+#define NRF_SIM_PORT(pin) NRF_SIM_PORT_(pin)
+#define NRF_SIM_PORT_(p, b) SIM_PORT_##p
+#define NRF_SIM_BIT(pin) NRF_SIM_BIT_(pin)
+#define NRF_SIM_BIT_(p, b) (1 << (b))
+
+#define NRF_PORT NRF_SIM_PORT(NRF_CE)
+_Static_assert(NRF_SIM_PORT(NRF_CSN) == NRF_PORT && NRF_SIM_PORT(NRF_SCK) == NRF_PORT &&
+	NRF_SIM_PORT(NRF_MOSI) == NRF_PORT && NRF_SIM_PORT(NRF_MISO) == NRF_PORT,
+	"the radio model needs all radio pins on one port");
+
+#define NRF_FIFO      3
+#define NRF_PAYLOAD   32
+#define NRF_SETTLE_US 130	// Standby to TX or RX
+#define NRF_POLL_US   100	// How often the air is checked
+#define NRF_PENDING   16	// Frames in flight towards this radio
+#define NRF_MAGIC     0x6E524624
+
+enum nrf_mode { NRF_OFF, NRF_STANDBY, NRF_RX, NRF_TX_SETTLE, NRF_TX_AIR, NRF_TX_ACK };
+enum nrf_frame_type { NRF_DATA, NRF_ACK };
+
+typedef struct nrf_frame {
+	uint32_t magic;
+	uint32_t sender;	// pid of the sending process
+	uint8_t type;
+	uint8_t channel;
+	uint8_t rate;		// RF_DR bit of RF_SETUP
+	uint8_t aw;		// address bytes
+	uint8_t addr[5];
+	uint8_t pid;		// 2 bit packet id
+	uint8_t len;
+	uint8_t payload[NRF_PAYLOAD];
+} nrf_frame;
+
+typedef struct nrf_fifo_entry {
+	uint8_t len;
+	uint8_t pipe;
+	uint8_t data[NRF_PAYLOAD];
+} nrf_fifo_entry;
+
+static struct {
+	uint8_t reg[0x20];
+	uint8_t addr[7][5];		// RX_ADDR_P0 to P5, then TX_ADDR
+	nrf_fifo_entry rx[NRF_FIFO], tx[NRF_FIFO];
+	uint8_t rx_count, tx_count, tx_reuse;
+	// SPI
+	uint8_t selected, bits, in, out, miso, index, cmd;
+	uint8_t buf[NRF_PAYLOAD];
+	// Radio
+	uint8_t ce, mode, pid, retries;
+	uint64_t until;			// End of the current settle, frame or ack wait
+	uint64_t tx_start;		// When CE started the current payload
+	uint32_t last_sender[6];	// For duplicate rejection, per pipe
+	uint8_t last_pid[6];
+	// Air
+	int sock;
+	char path[108];
+	const char *air;
+	nrf_frame pending[NRF_PENDING];
+	uint64_t due[NRF_PENDING];
+	uint8_t pending_count;
+	uint32_t loss;			// Per 2^32
+	uint64_t latency, jam_period, jam_length;
+	uint32_t seed;
+} nrf;
+
+static struct {
+	unsigned long sent, delivered, lost, aborted, retransmits, received, duplicates;
+	unsigned long overflows, dropped;
+	unsigned long long bytes;
+	uint64_t latency_sum, latency_max;
+} nrf_stats;
+
+////////////////////////////////////////////////////////////////////////////////
+// Registers
+
+static uint8_t nrf_aw(void) {
+	uint8_t aw = nrf.reg[SETUP_AW] & 0x03;
+	return aw ? aw + 2 : 5;
+}
+
+static uint8_t nrf_status(void) {
+	return (nrf.reg[STATUS] & 0x70) |
+		((nrf.rx_count ? nrf.rx[0].pipe : 7) << RX_P_NO) |
+		(nrf.tx_count == NRF_FIFO ? 1 << TX_FULL : 0);
+}
+
+static uint8_t nrf_read(uint8_t r, uint8_t i) {
+	switch (r) {
+		case STATUS:
+			return nrf_status();
+		case FIFO_STATUS:
+			return (nrf.tx_reuse << TX_REUSE) |
+				(nrf.tx_count == NRF_FIFO ? 1 << FIFO_FULL : 0) |
+				(nrf.tx_count ? 0 : 1 << TX_EMPTY) |
+				(nrf.rx_count == NRF_FIFO ? 1 << RX_FULL : 0) |
+				(nrf.rx_count ? 0 : 1 << RX_EMPTY);
+		case RX_ADDR_P0: case RX_ADDR_P1: case TX_ADDR:
+			return i < 5 ? nrf.addr[r == TX_ADDR ? 6 : r - RX_ADDR_P0][i] : 0;
+		case RX_ADDR_P2: case RX_ADDR_P3: case RX_ADDR_P4: case RX_ADDR_P5:
+			return nrf.addr[r - RX_ADDR_P0][0];
+		default:
+			return nrf.reg[r];
+	}
+}
+
+static void nrf_write(uint8_t r, const uint8_t *value, uint8_t len) {
+	uint8_t i;
+	if (!len) {
+		return;
+	}
+	switch (r) {
+		case STATUS:
+			// Interrupt flags clear by writing a one
+			nrf.reg[STATUS] &= ~(value[0] & 0x70);
+			break;
+		case FIFO_STATUS: case OBSERVE_TX: case CD:
+			break;
+		case RX_ADDR_P0: case RX_ADDR_P1: case TX_ADDR:
+			for (i = 0; i < len && i < 5; i++) {
+				nrf.addr[r == TX_ADDR ? 6 : r - RX_ADDR_P0][i] = value[i];
+			}
+			break;
+		case RX_ADDR_P2: case RX_ADDR_P3: case RX_ADDR_P4: case RX_ADDR_P5:
+			nrf.addr[r - RX_ADDR_P0][0] = value[0];
+			break;
+		case RF_CH:
+			// Changing channel restarts the lost packet count
+			nrf.reg[OBSERVE_TX] &= 0x0F;
+			nrf.reg[r] = value[0] & 0x7F;
+			break;
+		default:
+			nrf.reg[r] = value[0];
+	}
+}
+
+static void nrf_reset(void) {
+	uint8_t p;
+	memset(nrf.reg, 0, sizeof(nrf.reg));
+	nrf.reg[CONFIG] = 1 << EN_CRC;
+	nrf.reg[EN_AA] = 0x3F;
+	nrf.reg[EN_RXADDR] = (1 << ERX_P0) | (1 << ERX_P1);
+	nrf.reg[SETUP_AW] = 0x03;
+	nrf.reg[SETUP_RETR] = 0x03;
+	nrf.reg[RF_CH] = 0x02;
+	nrf.reg[RF_SETUP] = 0x0F;
+	memset(nrf.addr[0], 0xE7, 5);
+	memset(nrf.addr[1], 0xC2, 5);
+	for (p = 2; p < 6; p++) {
+		nrf.addr[p][0] = 0xC1 + p;
+	}
+	memset(nrf.addr[6], 0xE7, 5);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Air
+
+static uint32_t nrf_random(void) {
+	nrf.seed ^= nrf.seed << 13;
+	nrf.seed ^= nrf.seed >> 17;
+	nrf.seed ^= nrf.seed << 5;
+	return nrf.seed;
+}
+
+// Time a frame of len payload bytes takes on the air
+static uint64_t nrf_air_time(uint8_t len) {
+	uint8_t crc = nrf.reg[CONFIG] & (1 << EN_CRC) ? (nrf.reg[CONFIG] & (1 << CRCO) ? 2 : 1) : 0;
+	// Preamble, address, 9 bit packet control field, payload and CRC
+	uint32_t bits = 8 * (1 + nrf_aw() + len + crc) + 9;
+	return SIM_US(nrf.reg[RF_SETUP] & (1 << RF_DR) ? bits / 2 : bits);
+}
+
+// Sends a frame to every other radio on the same air
+static void nrf_broadcast(nrf_frame *f) {
+	struct sockaddr_un to;
+	struct dirent *e;
+	DIR *dir;
+	if (nrf.sock < 0 || !(dir = opendir(nrf.air))) {
+		return;
+	}
+	f->magic = NRF_MAGIC;
+	f->sender = getpid();
+	f->channel = nrf.reg[RF_CH];
+	f->rate = nrf.reg[RF_SETUP] & (1 << RF_DR);
+	f->aw = nrf_aw();
+	memset(&to, 0, sizeof(to));
+	to.sun_family = AF_UNIX;
+	while ((e = readdir(dir))) {
+		if (e->d_name[0] == '.' ||
+				snprintf(to.sun_path, sizeof(to.sun_path), "%s/%s", nrf.air, e->d_name) >=
+				(int)sizeof(to.sun_path) || !strcmp(to.sun_path, nrf.path)) {
+			continue;
+		}
+		if (sendto(nrf.sock, f, sizeof(*f), 0, (struct sockaddr *)&to, sizeof(to)) < 0 &&
+				(errno == ECONNREFUSED || errno == ENOENT)) {
+			// Left behind by a process that has gone
+			unlink(to.sun_path);
+		}
+	}
+	closedir(dir);
+}
+
+static uint8_t nrf_addr_match(const nrf_frame *f, uint8_t pipe) {
+	const uint8_t *a = nrf.addr[pipe < 2 ? pipe : 1];
+	if (memcmp(f->addr + 1, a + 1, f->aw - 1)) {
+		return 0;
+	}
+	return f->addr[0] == nrf.addr[pipe][0];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Transmitter
+
+static void nrf_tx_frame(uint64_t now) {
+	nrf_frame f;
+	memset(&f, 0, sizeof(f));
+	f.type = NRF_DATA;
+	memcpy(f.addr, nrf.addr[6], 5);
+	f.pid = nrf.pid;
+	f.len = nrf.tx[0].len;
+	memcpy(f.payload, nrf.tx[0].data, f.len);
+	nrf_broadcast(&f);
+	nrf.mode = NRF_TX_AIR;
+	nrf.until = now + nrf_air_time(f.len);
+}
+
+// Ends the current payload, sent or given up on
+static void nrf_tx_done(uint64_t now, uint8_t flag) {
+	uint64_t latency = now - nrf.tx_start;
+	uint8_t plos = nrf.reg[OBSERVE_TX] >> PLOS_CNT;
+	nrf.reg[STATUS] |= 1 << flag;
+	if (flag == TX_DS) {
+		nrf_stats.delivered++;
+		nrf_stats.bytes += nrf.tx[0].len;
+		if (!nrf.tx_reuse) {
+			memmove(nrf.tx, nrf.tx + 1, sizeof(nrf.tx[0]) * --nrf.tx_count);
+		}
+	}
+	else {
+		// The payload stays in the FIFO
+		nrf_stats.lost++;
+		plos = plos < 15 ? plos + 1 : plos;
+	}
+	nrf.reg[OBSERVE_TX] = (plos << PLOS_CNT) | nrf.retries;
+	nrf_stats.latency_sum += latency;
+	nrf_stats.latency_max = latency > nrf_stats.latency_max ? latency : nrf_stats.latency_max;
+	nrf.mode = NRF_STANDBY;
+}
+
+// Starts whatever CE, CONFIG and the FIFOs now call for
+static void nrf_update(uint64_t now) {
+	uint8_t config = nrf.reg[CONFIG];
+	if (nrf.mode >= NRF_TX_SETTLE && (config & ((1 << PWR_UP) | (1 << PRIM_RX))) != (1 << PWR_UP)) {
+		// Powered down or switched to RX part way through
+		nrf_stats.aborted++;
+	}
+	if (!(config & (1 << PWR_UP))) {
+		nrf.mode = NRF_OFF;
+	}
+	else if (config & (1 << PRIM_RX)) {
+		nrf.mode = nrf.ce ? NRF_RX : NRF_STANDBY;
+	}
+	else if (nrf.mode == NRF_RX || nrf.mode == NRF_OFF) {
+		nrf.mode = NRF_STANDBY;
+	}
+	// Stalls on MAX_RT until it is cleared
+	if (nrf.mode == NRF_STANDBY && !(config & (1 << PRIM_RX)) && nrf.ce &&
+			nrf.tx_count && !(nrf.reg[STATUS] & (1 << MAX_RT))) {
+		nrf.mode = NRF_TX_SETTLE;
+		nrf.until = now + SIM_US(NRF_SETTLE_US);
+		nrf.tx_start = now;
+		nrf.retries = 0;
+		nrf.pid = (nrf.pid + 1) & 0x03;
+		nrf_stats.sent++;
+	}
+}
+
+static void nrf_tx_timer(uint64_t now) {
+	uint8_t arc = nrf.reg[SETUP_RETR] & 0x0F;
+	if (nrf.mode == NRF_TX_SETTLE && now >= nrf.until) {
+		nrf_tx_frame(now);
+	}
+	if (nrf.mode == NRF_TX_AIR && now >= nrf.until) {
+		if (!(nrf.reg[EN_AA] & (1 << ENAA_P0)) || !arc) {
+			nrf_tx_done(now, TX_DS);
+			nrf_update(now);
+			return;
+		}
+		nrf.mode = NRF_TX_ACK;
+		nrf.until = now + SIM_US(250 * ((nrf.reg[SETUP_RETR] >> ARD) + 1));
+	}
+	if (nrf.mode == NRF_TX_ACK && now >= nrf.until) {
+		if (nrf.retries < arc) {
+			nrf.retries++;
+			nrf_stats.retransmits++;
+			nrf_tx_frame(now);
+		}
+		else {
+			nrf_tx_done(now, MAX_RT);
+			nrf_update(now);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Receiver
+
+static void nrf_rx_frame(const nrf_frame *f, uint64_t now) {
+	nrf_frame ack;
+	uint8_t pipe;
+	if (f->channel != nrf.reg[RF_CH] || f->rate != (nrf.reg[RF_SETUP] & (1 << RF_DR)) ||
+			f->aw != nrf_aw()) {
+		return;
+	}
+	if (f->type == NRF_ACK) {
+		// Acks come back to the transmit address, which pipe 0 listens on
+		if ((nrf.mode == NRF_TX_ACK || nrf.mode == NRF_TX_AIR) && f->pid == nrf.pid &&
+				nrf_addr_match(f, 0)) {
+			nrf_tx_done(now, TX_DS);
+			nrf_update(now);
+		}
+		return;
+	}
+	if (nrf.mode != NRF_RX) {
+		return;
+	}
+	for (pipe = 0; pipe < 6; pipe++) {
+		if ((nrf.reg[EN_RXADDR] & (1 << pipe)) && nrf.reg[RX_PW_P0 + pipe] == f->len &&
+				nrf_addr_match(f, pipe)) {
+			break;
+		}
+	}
+	if (pipe == 6) {
+		return;
+	}
+	if (nrf.last_sender[pipe] == f->sender && nrf.last_pid[pipe] == f->pid) {
+		// A retransmit of what we already have, our ack got lost
+		nrf_stats.duplicates++;
+	}
+	else if (nrf.rx_count == NRF_FIFO) {
+		// Not acked, so the transmitter tries again
+		nrf_stats.overflows++;
+		return;
+	}
+	else {
+		nrf.rx[nrf.rx_count].len = f->len;
+		nrf.rx[nrf.rx_count].pipe = pipe;
+		memcpy(nrf.rx[nrf.rx_count].data, f->payload, f->len);
+		nrf.rx_count++;
+		nrf.reg[STATUS] |= 1 << RX_DR;
+		nrf.last_sender[pipe] = f->sender;
+		nrf.last_pid[pipe] = f->pid;
+		nrf_stats.received++;
+	}
+	if (nrf.reg[EN_AA] & (1 << pipe)) {
+		memset(&ack, 0, sizeof(ack));
+		ack.type = NRF_ACK;
+		memcpy(ack.addr, f->addr, 5);
+		ack.pid = f->pid;
+		nrf_broadcast(&ack);
+	}
+}
+
+// Hands payload to the radio as if a transmitter had sent it to pipe
+// 1's address, for models standing in for the far end. Returns 0 when
+// it wasn't taken: not listening, wrong width or the RX FIFO full.
+uint8_t nrf_sim_receive(const uint8_t *payload, uint8_t len) {
+	static uint8_t pid;
+	nrf_frame f;
+	unsigned long received = nrf_stats.received;
+	if (nrf.mode != NRF_RX || len > NRF_PAYLOAD) {
+		return 0;
+	}
+	memset(&f, 0, sizeof(f));
+	f.sender = ~(uint32_t)0;
+	f.channel = nrf.reg[RF_CH];
+	f.rate = nrf.reg[RF_SETUP] & (1 << RF_DR);
+	f.aw = nrf_aw();
+	memcpy(f.addr, nrf.addr[1], 5);
+	f.pid = pid = (pid + 1) & 0x03;
+	f.len = len;
+	memcpy(f.payload, payload, len);
+	nrf_rx_frame(&f, sim_cycles());
+	return nrf_stats.received != received;
+}
+
+// Takes frames off the socket, keeping the ones that survive the air
+static void nrf_listen(uint64_t now) {
+	nrf_frame f;
+	uint64_t t;
+	while (nrf.sock >= 0 && recv(nrf.sock, &f, sizeof(f), MSG_DONTWAIT) == sizeof(f)) {
+		if (f.magic != NRF_MAGIC || f.len > NRF_PAYLOAD || f.aw < 3 || f.aw > 5) {
+			continue;
+		}
+		t = nrf.jam_period ? now % nrf.jam_period : nrf.jam_length;
+		if ((nrf.loss && nrf_random() < nrf.loss) || t < nrf.jam_length ||
+				nrf.pending_count == NRF_PENDING) {
+			nrf_stats.dropped++;
+			continue;
+		}
+		nrf.pending[nrf.pending_count] = f;
+		nrf.due[nrf.pending_count] = now + nrf.latency;
+		nrf.pending_count++;
+	}
+}
+
+static uint64_t nrf_poll(uint64_t now) {
+	uint64_t next = now + SIM_US(NRF_POLL_US);
+	uint8_t i = 0;
+	nrf_listen(now);
+	while (i < nrf.pending_count) {
+		if (nrf.due[i] <= now) {
+			nrf_frame f = nrf.pending[i];
+			nrf.pending_count--;
+			memmove(nrf.pending + i, nrf.pending + i + 1, sizeof(nrf.pending[0]) * (nrf.pending_count - i));
+			memmove(nrf.due + i, nrf.due + i + 1, sizeof(nrf.due[0]) * (nrf.pending_count - i));
+			nrf_rx_frame(&f, now);
+		}
+		else {
+			next = nrf.due[i] < next ? nrf.due[i] : next;
+			i++;
+		}
+	}
+	nrf_tx_timer(now);
+	if (nrf.mode >= NRF_TX_SETTLE && nrf.until < next) {
+		next = nrf.until;
+	}
+	return next;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SPI
+
+// Takes one byte from the master, returns the next one to shift out
+static uint8_t nrf_spi_byte(uint8_t b) {
+	uint8_t i = nrf.index++;
+	if (i == 0) {
+		nrf.cmd = b;
+	}
+	else if (i <= NRF_PAYLOAD) {
+		nrf.buf[i - 1] = b;
+	}
+	if (nrf.cmd < W_REGISTER) {
+		return nrf_read(nrf.cmd & REGISTER_MASK, i);
+	}
+	if (nrf.cmd == R_RX_PAYLOAD) {
+		return nrf.rx_count && i < nrf.rx[0].len ? nrf.rx[0].data[i] : 0;
+	}
+	if (nrf.cmd == R_RX_PL_WID) {
+		return nrf.rx_count ? nrf.rx[0].len : 0;
+	}
+	return 0;
+}
+
+// Carries out the command once CSN goes high
+static void nrf_spi_end(void) {
+	uint8_t len = nrf.index ? nrf.index - 1 : 0;
+	len = len > NRF_PAYLOAD ? NRF_PAYLOAD : len;
+	if (!nrf.index) {
+		return;
+	}
+	if ((nrf.cmd & 0xE0) == W_REGISTER) {
+		nrf_write(nrf.cmd & REGISTER_MASK, nrf.buf, len);
+	}
+	else if (nrf.cmd == W_TX_PAYLOAD) {
+		if (nrf.tx_count < NRF_FIFO && len) {
+			nrf.tx[nrf.tx_count].len = len;
+			memcpy(nrf.tx[nrf.tx_count].data, nrf.buf, len);
+			nrf.tx_count++;
+			nrf.tx_reuse = 0;
+		}
+	}
+	else if (nrf.cmd == R_RX_PAYLOAD) {
+		if (nrf.rx_count && len) {
+			memmove(nrf.rx, nrf.rx + 1, sizeof(nrf.rx[0]) * --nrf.rx_count);
+		}
+	}
+	else if (nrf.cmd == FLUSH_TX) {
+		nrf.tx_count = 0;
+		nrf.tx_reuse = 0;
+	}
+	else if (nrf.cmd == FLUSH_RX) {
+		nrf.rx_count = 0;
+	}
+	else if (nrf.cmd == REUSE_TX_PL) {
+		nrf.tx_reuse = 1;
+	}
+}
+
+static void nrf_pin_output(uint8_t port, uint8_t before, uint8_t after) {
+	uint8_t rise = ~before & after, fall = before & ~after;
+	uint64_t now = sim_cycles();
+	if (port != NRF_PORT) {
+		return;
+	}
+	if (fall & NRF_SIM_BIT(NRF_CSN)) {
+		nrf.selected = 1;
+		nrf.bits = 0;
+		nrf.index = 0;
+		// The status register shifts out with the command
+		nrf.out = nrf_status();
+		nrf.miso = nrf.out >> 7;
+	}
+	if (nrf.selected && (rise & NRF_SIM_BIT(NRF_SCK))) {
+		// Sampled on the rising edge, MSB first
+		nrf.in = (nrf.in << 1) | !!(after & NRF_SIM_BIT(NRF_MOSI));
+		if (++nrf.bits == 8) {
+			nrf.out = nrf_spi_byte(nrf.in);
+			nrf.bits = 0;
+		}
+	}
+	if (nrf.selected && (fall & NRF_SIM_BIT(NRF_SCK))) {
+		nrf.miso = (nrf.out >> (7 - nrf.bits)) & 1;
+	}
+	if (rise & NRF_SIM_BIT(NRF_CSN)) {
+		nrf.selected = 0;
+		nrf_spi_end();
+	}
+	nrf.ce = !!(after & NRF_SIM_BIT(NRF_CE));
+	if ((rise | fall) & (NRF_SIM_BIT(NRF_CSN) | NRF_SIM_BIT(NRF_CE))) {
+		nrf_update(now);
+	}
+}
+
+static uint8_t nrf_pin_input(uint8_t port, uint8_t levels) {
+	if (port != NRF_PORT || !nrf.selected) {
+		return levels;
+	}
+	return nrf.miso ? levels | NRF_SIM_BIT(NRF_MISO) : levels & ~NRF_SIM_BIT(NRF_MISO);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void nrf_report(void) {
+	double s = sim_cycles() / (double)F_CPU;
+	unsigned long done = nrf_stats.delivered + nrf_stats.lost;
+	fprintf(stderr, "nrf: sent %lu, delivered %lu, lost %lu, aborted %lu, retransmits %lu\n",
+		nrf_stats.sent, nrf_stats.delivered, nrf_stats.lost, nrf_stats.aborted,
+		nrf_stats.retransmits);
+	fprintf(stderr, "nrf: received %lu, duplicates %lu, rx fifo full %lu, dropped on air %lu\n",
+		nrf_stats.received, nrf_stats.duplicates, nrf_stats.overflows, nrf_stats.dropped);
+	fprintf(stderr, "nrf: throughput %.1f bytes/s, tx latency avg %.0f us max %.0f us\n",
+		s > 0 ? nrf_stats.bytes / s : 0.0,
+		done ? nrf_stats.latency_sum * 1e6 / F_CPU / done : 0.0,
+		nrf_stats.latency_max * 1e6 / F_CPU);
+}
+
+static void nrf_close(void) {
+	if (nrf.sock >= 0) {
+		close(nrf.sock);
+		unlink(nrf.path);
+	}
+}
+
+static sim_device nrf_device = {
+	.pin_input = nrf_pin_input,
+	.pin_output = nrf_pin_output,
+	.poll = nrf_poll,
+	.report = nrf_report,
+};
+
+__attribute__((constructor)) static void nrf_attach(void) {
+	struct sockaddr_un addr;
+	const char *jam = getenv("SIM_NRF_JAM");
+	unsigned long period = 0, length = 0;
+	nrf_reset();
+	nrf.air = getenv("SIM_NRF_AIR") ? getenv("SIM_NRF_AIR") : "/tmp/nrf24-air";
+	nrf.loss = getenv("SIM_NRF_LOSS") ? atof(getenv("SIM_NRF_LOSS")) / 100 * 4294967295.0 : 0;
+	nrf.latency = SIM_US(getenv("SIM_NRF_LATENCY") ? strtoul(getenv("SIM_NRF_LATENCY"), 0, 0) : 0);
+	if (jam && sscanf(jam, "%lu,%lu", &period, &length) == 2 && period) {
+		nrf.jam_period = SIM_US(period * 1000);
+		nrf.jam_length = SIM_US(length * 1000);
+	}
+	nrf.seed = getenv("SIM_NRF_SEED") ? strtoul(getenv("SIM_NRF_SEED"), 0, 0) : 1;
+	nrf.seed = nrf.seed ? nrf.seed : 1;
+
+	mkdir(nrf.air, 0777);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(nrf.path, sizeof(nrf.path), "%s/%d", nrf.air, (int)getpid());
+	strncpy(addr.sun_path, nrf.path, sizeof(addr.sun_path) - 1);
+	// Left by this process before a watchdog reset, see sim.h
+	unlink(nrf.path);
+	nrf.sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (nrf.sock < 0 || bind(nrf.sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "nrf: can't open %s, the radio is off the air\n", nrf.path);
+		if (nrf.sock >= 0) {
+			close(nrf.sock);
+		}
+		nrf.sock = -1;
+	}
+	atexit(nrf_close);
+	sim_pace(1);
+	sim_attach(&nrf_device);
+}
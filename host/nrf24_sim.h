@@ -0,0 +1,16 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef NRF24_SIM_H
+#define NRF24_SIM_H
+
+#include <stdint.h>
+
+// Delivers payload to the simulated radio as a frame sent to its pipe 1
+// address, for device models that play the far end of the link. Returns
+// 0 if the radio didn't take it, in which case it is worth trying again.
+uint8_t nrf_sim_receive(const uint8_t *payload, uint8_t len);
+
+#endif
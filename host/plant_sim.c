@@ -0,0 +1,447 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The window's surroundings for the host build: a room, the weather
+// outside it and the window mechanism, for tuning the auto mode against
+// days of simulated weather in seconds.
+//
+//  - two DS18B20s, outdoors on PB0 and indoors on PB1, answering skip
+//    ROM, convert T (750 ms) and read scratchpad with the plant's
+//    temperatures in 12 bit resolution
+//  - the stepper on PC0 (step), PC1 (direction) and PC2 (sleep) moving
+//    the window between the seal and the open stop, the open end switch
+//    on PD4 and the seal's force sensor on ADC channel 0
+//  - the room as one thermal mass settling towards the outdoor
+//    temperature, faster the further the window is open, and warmed by
+//    internal and solar gains. Outdoors follows a daily sine.
+//
+// The plant's clock runs SIM_PLANT_SCALE times faster than the
+// firmware's while the motor sleeps, and in step with it while the
+// motor is awake so travel takes its real time. The firmware still sees
+// every step, sensor conversion and timeout at its own pace, only the
+// room and the weather move faster: at a scale of 200 each 3 s
+// temperature reading is 10 minutes apart in the room. Options, from
+// the environment, temperatures in degrees F as the firmware uses:
+//  SIM_PLANT_SCALE    plant seconds per firmware second, 1 by default
+//  SIM_PLANT_HOURS    plant hours to run before exiting, 0 to leave it
+//                     to SIM_MS
+//  SIM_PLANT_AUTO     max,min sent to the firmware as an auto command
+//                     once it listens; without it the window stays shut
+//  SIM_PLANT_BAND     min,max of the comfort band, the auto thresholds
+//                     or 68,76 by default
+//  SIM_PLANT_START    hour of the day the run starts at, 12
+//  SIM_PLANT_INDOOR   indoor temperature at the start, 78
+//  SIM_PLANT_OUTDOOR  mean,swing of the outdoor temperature, 64,12
+//  SIM_PLANT_TAU      hours the room takes to settle towards outdoors
+//                     with the window shut,fully open; 6,0.5
+//  SIM_PLANT_GAIN     internal,peak solar heating in degrees per hour;
+//                     0.5,3
+//  SIM_PLANT_TRAVEL   steps from the seal to the open stop, 6000
+//  SIM_PLANT_POS      steps the window is open at the start, 0
+//  SIM_PLANT_MOTOR_W  power drawn while the motor is awake, 5 W
+//
+// At exit it reports the motor cycles, steps and energy, the time spent
+// outside the comfort band and how long the room took to get back in.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+#include "nrf24_sim.h"
+
+// As wired in window/main.c and include/ds18b20.h
+#define PLANT_STEP       (1 << 0)	// PORTC
+#define PLANT_DIR        (1 << 1)	// PORTC, high closes
+#define PLANT_SLEEP      (1 << 2)	// PORTC, high runs the motor
+#define PLANT_OPEN_LIMIT (1 << 4)	// PORTD, low at the open stop
+#define PLANT_FORCE      0		// ADC channel
+#define PLANT_CMD_AUTO   3		// Remote command: auto, max, min
+#define PLANT_PAYLOAD    4
+
+#define PLANT_POLL_US    10000		// Firmware time between plant updates
+#define PLANT_STEP_S     60.0		// Longest integration step of the room
+#define PLANT_SEAL       100		// Steps from first touching the seal to seated
+#define PLANT_FORCE_IDLE 40		// Force sensor reading off the seal
+#define PLANT_FORCE_STEP 3		// Rise per step into the seal
+
+// DS18B20 timing in us
+#define THERM_RESET_US   400		// Shortest low that resets the slave
+#define THERM_ONE_US     15		// Longer lows write a 0
+#define THERM_WAIT_US    20		// Presence pulse after the reset
+#define THERM_PRESENT_US 120
+#define THERM_HOLD_US    30		// A 0 read is held low this long
+#define THERM_CONVERT_US 750000
+
+enum therm_state { THERM_IDLE, THERM_ROM, THERM_FUNCTION, THERM_CONVERT, THERM_SEND };
+
+typedef struct plant_therm {
+	uint8_t low;			// Master holding the bus low
+	uint8_t state, bits, byte, sent;
+	uint64_t fell;			// When the master last pulled low
+	uint64_t present, hold;		// Ends of the presence pulse and a held 0
+	uint64_t done;			// End of the running conversion, 0 if none
+	int16_t result;			// Of the running conversion
+	uint8_t scratch[9];
+	const double *temp;
+} plant_therm;
+
+static struct {
+	// Room and weather
+	double scale, hours, start, t;	// t in plant seconds
+	double indoor, outdoor, out_mean, out_swing;
+	double tau_shut, tau_open, gain_int, gain_sun;
+	double lo, hi;			// Comfort band
+	int auto_max, auto_min;
+	uint8_t auto_pending;
+	uint64_t last;
+	clock_t host_start;
+	// Window
+	int32_t pos, travel;
+	uint8_t awake, opening;
+	uint64_t woke;
+	unsigned long move_steps;
+	double motor_w;
+	plant_therm therm[2];		// Outdoor on PB0, indoor on PB1
+} plant;
+
+static struct {
+	unsigned long opens, closes, steps;
+	uint64_t awake;
+	double in_min, in_max, out_min, out_max;
+	double outside, degree_hours;	// Plant seconds and degree hours out of band
+	double settled;			// First entry into the band, < 0 until then
+	double left;			// Start of the current excursion, < 0 if in band
+	unsigned long excursions, recoveries;
+	double recovery_sum, recovery_max;
+} plant_stats;
+
+static void plant_pair(const char *name, double *a, double *b) {
+	const char *v = getenv(name);
+	if (v) {
+		sscanf(v, "%lf,%lf", a, b);
+	}
+}
+
+static double plant_env(const char *name, double value) {
+	return getenv(name) ? atof(getenv(name)) : value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Room
+
+static double plant_hour(void) {
+	return fmod(plant.start + plant.t / 3600, 24);
+}
+
+static void plant_track(double dt) {
+	double d = plant.indoor < plant.lo ? plant.lo - plant.indoor :
+		plant.indoor > plant.hi ? plant.indoor - plant.hi : 0;
+	if (d > 0) {
+		if (plant_stats.left < 0) {
+			plant_stats.left = plant.t;
+			plant_stats.excursions++;
+		}
+		plant_stats.outside += dt;
+		plant_stats.degree_hours += d * dt / 3600;
+	}
+	else {
+		if (plant_stats.settled < 0) {
+			plant_stats.settled = plant.t;
+		}
+		if (plant_stats.left >= 0) {
+			d = plant.t - plant_stats.left;
+			plant_stats.recovery_sum += d;
+			plant_stats.recovery_max = d > plant_stats.recovery_max ? d : plant_stats.recovery_max;
+			plant_stats.recoveries++;
+			plant_stats.left = -1;
+		}
+	}
+	plant_stats.in_min = plant.indoor < plant_stats.in_min ? plant.indoor : plant_stats.in_min;
+	plant_stats.in_max = plant.indoor > plant_stats.in_max ? plant.indoor : plant_stats.in_max;
+	plant_stats.out_min = plant.outdoor < plant_stats.out_min ? plant.outdoor : plant_stats.out_min;
+	plant_stats.out_max = plant.outdoor > plant_stats.out_max ? plant.outdoor : plant_stats.out_max;
+}
+
+// Moves the room and the weather on by dt plant seconds
+static void plant_run(double dt) {
+	double h, step, open, rate, sun;
+	while (dt > 0) {
+		step = dt < PLANT_STEP_S ? dt : PLANT_STEP_S;
+		h = plant_hour();
+		plant.outdoor = plant.out_mean + plant.out_swing * sin(2 * M_PI * (h - 9) / 24);
+		// Per hour, through the walls and the opening
+		open = (double)plant.pos / plant.travel;
+		rate = 1 / plant.tau_shut + open / plant.tau_open;
+		sun = sin(M_PI * (h - 7) / 12);
+		plant.indoor += (rate * (plant.outdoor - plant.indoor) + plant.gain_int +
+			(sun > 0 ? plant.gain_sun * sun : 0)) * step / 3600;
+		plant.t += step;
+		dt -= step;
+		plant_track(step);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DS18B20
+
+static uint8_t therm_crc(const uint8_t *data, uint8_t len) {
+	uint8_t crc = 0, i, j, b;
+	for (i = 0; i < len; i++) {
+		b = data[i];
+		for (j = 0; j < 8; j++) {
+			crc = ((crc ^ b) & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+			b >>= 1;
+		}
+	}
+	return crc;
+}
+
+static void therm_reset(plant_therm *t) {
+	static const uint8_t power_on[9] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0 };
+	memcpy(t->scratch, power_on, sizeof(power_on));
+	t->scratch[8] = therm_crc(t->scratch, 8);
+}
+
+// Latches the result once the conversion has had its time
+static void therm_finish(plant_therm *t, uint64_t now) {
+	if (t->done && now >= t->done) {
+		t->done = 0;
+		t->scratch[0] = t->result & 0xFF;
+		t->scratch[1] = (uint16_t)t->result >> 8;
+		t->scratch[8] = therm_crc(t->scratch, 8);
+	}
+}
+
+static void therm_command(plant_therm *t, uint64_t now) {
+	if (t->state == THERM_ROM) {
+		t->state = t->byte == 0xCC ? THERM_FUNCTION : THERM_IDLE;
+	}
+	else if (t->byte == 0x44) {
+		// Degrees C in 1/16ths
+		t->result = (int16_t)lround((*t->temp - 32) * 5 / 9 * 16);
+		t->done = now + SIM_US(THERM_CONVERT_US);
+		t->state = THERM_CONVERT;
+	}
+	else if (t->byte == 0xBE) {
+		therm_finish(t, now);
+		t->sent = 0;
+		t->state = THERM_SEND;
+	}
+	else {
+		t->state = THERM_IDLE;
+	}
+}
+
+static void therm_edge(plant_therm *t, uint8_t low, uint64_t now) {
+	uint8_t bit;
+	if (low == t->low) {
+		return;
+	}
+	t->low = low;
+	if (low) {
+		t->fell = now;
+		// Read slots: a 0 is the slave holding the bus past the master
+		if (t->state == THERM_CONVERT) {
+			therm_finish(t, now);
+			t->hold = t->done ? now + SIM_US(THERM_HOLD_US) : 0;
+		}
+		else if (t->state == THERM_SEND) {
+			bit = t->scratch[t->sent / 8] >> (t->sent % 8) & 1;
+			t->hold = bit ? 0 : now + SIM_US(THERM_HOLD_US);
+			if (++t->sent == 8 * sizeof(t->scratch)) {
+				t->state = THERM_IDLE;
+			}
+		}
+		return;
+	}
+	if (now - t->fell >= SIM_US(THERM_RESET_US)) {
+		t->present = now + SIM_US(THERM_WAIT_US + THERM_PRESENT_US);
+		t->state = THERM_ROM;
+		t->bits = 0;
+	}
+	else if (t->state == THERM_ROM || t->state == THERM_FUNCTION) {
+		t->byte = (t->byte >> 1) | (now - t->fell < SIM_US(THERM_ONE_US) ? 0x80 : 0);
+		if (++t->bits == 8) {
+			t->bits = 0;
+			therm_command(t, now);
+		}
+	}
+}
+
+// Bus is held low by the slave at now
+static uint8_t therm_holding(const plant_therm *t, uint64_t now) {
+	return (now < t->present && now + SIM_US(THERM_PRESENT_US) >= t->present) || now < t->hold;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Window mechanism
+
+static void plant_motor(uint8_t before, uint8_t after, uint64_t now) {
+	if ((after & PLANT_SLEEP) && !plant.awake) {
+		plant.awake = 1;
+		plant.woke = now;
+		plant.move_steps = 0;
+	}
+	else if (!(after & PLANT_SLEEP) && plant.awake) {
+		plant.awake = 0;
+		plant_stats.awake += now - plant.woke;
+		if (plant.move_steps) {
+			if (plant.opening) {
+				plant_stats.opens++;
+			}
+			else {
+				plant_stats.closes++;
+			}
+		}
+	}
+	if (plant.awake && (after & PLANT_STEP) && !(before & PLANT_STEP)) {
+		plant.opening = !(after & PLANT_DIR);
+		if (plant.opening && plant.pos < plant.travel) {
+			plant.pos++;
+		}
+		else if (!plant.opening && plant.pos > 0) {
+			plant.pos--;
+		}
+		plant.move_steps++;
+		plant_stats.steps++;
+	}
+}
+
+uint16_t sim_adc_input(uint8_t channel) {
+	if (channel != PLANT_FORCE) {
+		return 0;
+	}
+	return PLANT_FORCE_IDLE + (plant.pos < PLANT_SEAL ? (PLANT_SEAL - plant.pos) * PLANT_FORCE_STEP : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t plant_pin_input(uint8_t port, uint8_t levels) {
+	uint64_t now = sim_cycles();
+	uint8_t i;
+	if (port == SIM_PORT_B) {
+		for (i = 0; i < 2; i++) {
+			if (therm_holding(&plant.therm[i], now)) {
+				levels &= ~(1 << i);
+			}
+		}
+	}
+	else if (port == SIM_PORT_D && plant.pos >= plant.travel) {
+		levels &= ~PLANT_OPEN_LIMIT;
+	}
+	return levels;
+}
+
+static void plant_pin_output(uint8_t port, uint8_t before, uint8_t after) {
+	uint64_t now = sim_cycles();
+	uint8_t ddr, i;
+	if (port == SIM_PORT_B) {
+		ddr = sim_ddr(port);
+		for (i = 0; i < 2; i++) {
+			therm_edge(&plant.therm[i], (ddr & ~after) >> i & 1, now);
+		}
+	}
+	else if (port == SIM_PORT_C) {
+		plant_motor(before, after, now);
+	}
+}
+
+static uint64_t plant_poll(uint64_t now) {
+	uint8_t cmd[PLANT_PAYLOAD] = { PLANT_CMD_AUTO };
+	plant_run((double)(now - plant.last) / F_CPU * (plant.awake ? 1 : plant.scale));
+	plant.last = now;
+	// Any packet stops a moving window, so wait for it to rest
+	if (plant.auto_pending && !plant.awake) {
+		cmd[1] = plant.auto_max;
+		cmd[2] = plant.auto_min;
+		plant.auto_pending = !nrf_sim_receive(cmd, sizeof(cmd));
+	}
+	if (plant.hours > 0 && plant.t >= plant.hours * 3600) {
+		exit(0);
+	}
+	return now + SIM_US(PLANT_POLL_US);
+}
+
+static void plant_report(void) {
+	double host = (double)(clock() - plant.host_start) / CLOCKS_PER_SEC;
+	if (plant.auto_max || plant.auto_min) {
+		fprintf(stderr, "plant: strategy auto, max %d min %d\n", plant.auto_max, plant.auto_min);
+	}
+	else {
+		fprintf(stderr, "plant: strategy shut\n");
+	}
+	fprintf(stderr, "plant: %.1f h simulated in %.1f s host (%.0fx)\n", plant.t / 3600, host,
+		host > 0 ? plant.t / host : 0.0);
+	fprintf(stderr, "plant: indoor %.1f to %.1f F, outdoor %.1f to %.1f F\n",
+		plant_stats.in_min, plant_stats.in_max, plant_stats.out_min, plant_stats.out_max);
+	fprintf(stderr, "plant: motor %lu cycles (%lu open, %lu close), %lu steps, "
+		"%.1f s awake, %.3f Wh\n", plant_stats.opens + plant_stats.closes, plant_stats.opens,
+		plant_stats.closes, plant_stats.steps, (double)plant_stats.awake / F_CPU,
+		plant.motor_w * plant_stats.awake / F_CPU / 3600);
+	fprintf(stderr, "plant: band %.0f to %.0f F, outside %.2f h in %lu excursions, "
+		"%.1f degree hours\n", plant.lo, plant.hi, plant_stats.outside / 3600,
+		plant_stats.excursions, plant_stats.degree_hours);
+	if (plant_stats.settled < 0) {
+		fprintf(stderr, "plant: time to setpoint never");
+	}
+	else {
+		fprintf(stderr, "plant: time to setpoint %.2f h", plant_stats.settled / 3600);
+	}
+	fprintf(stderr, ", back in band avg %.2f h max %.2f h%s\n",
+		plant_stats.recoveries ? plant_stats.recovery_sum / plant_stats.recoveries / 3600 : 0.0,
+		plant_stats.recovery_max / 3600, plant_stats.left >= 0 ? ", still outside at exit" : "");
+}
+
+static sim_device plant_device = {
+	.pin_input = plant_pin_input,
+	.pin_output = plant_pin_output,
+	.poll = plant_poll,
+	.report = plant_report,
+};
+
+__attribute__((constructor)) static void plant_attach(void) {
+	double max = 0, min = 0;
+	plant.scale = plant_env("SIM_PLANT_SCALE", 1);
+	plant.hours = plant_env("SIM_PLANT_HOURS", 0);
+	plant.start = plant_env("SIM_PLANT_START", 12);
+	plant.indoor = plant_env("SIM_PLANT_INDOOR", 78);
+	plant.out_mean = 64;
+	plant.out_swing = 12;
+	plant_pair("SIM_PLANT_OUTDOOR", &plant.out_mean, &plant.out_swing);
+	plant.tau_shut = 6;
+	plant.tau_open = 0.5;
+	plant_pair("SIM_PLANT_TAU", &plant.tau_shut, &plant.tau_open);
+	plant.gain_int = 0.5;
+	plant.gain_sun = 3;
+	plant_pair("SIM_PLANT_GAIN", &plant.gain_int, &plant.gain_sun);
+	plant.lo = 68;
+	plant.hi = 76;
+	plant_pair("SIM_PLANT_AUTO", &max, &min);
+	if (max || min) {
+		plant.auto_max = max;
+		plant.auto_min = min;
+		plant.auto_pending = 1;
+		plant.lo = min;
+		plant.hi = max;
+	}
+	plant_pair("SIM_PLANT_BAND", &plant.lo, &plant.hi);
+	plant.travel = plant_env("SIM_PLANT_TRAVEL", 6000);
+	plant.pos = plant_env("SIM_PLANT_POS", 0);
+	plant.pos = plant.pos > plant.travel ? plant.travel : plant.pos;
+	plant.motor_w = plant_env("SIM_PLANT_MOTOR_W", 5);
+	plant.therm[0].temp = &plant.outdoor;
+	plant.therm[1].temp = &plant.indoor;
+	therm_reset(&plant.therm[0]);
+	therm_reset(&plant.therm[1]);
+	plant.host_start = clock();
+
+	plant_stats.in_min = plant_stats.out_min = INFINITY;
+	plant_stats.in_max = plant_stats.out_max = -INFINITY;
+	plant_stats.settled = plant_stats.left = -1;
+	plant.outdoor = plant.out_mean + plant.out_swing * sin(2 * M_PI * (plant_hour() - 9) / 24);
+	sim_attach(&plant_device);
+}
@@ -0,0 +1,83 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Buttons pressed on a schedule, for the host build. SIM_PRESS lists
+// the presses, comma separated, each as
+//
+//     <port><bit>@<ms>[/<period>][+<held>]
+//
+// pulling the pin low at ms of simulated time for held ms (100 by
+// default), and again every period ms if one is given. The remote's
+// OPEN and then CLOSE, every 10 s:
+//
+//     SIM_PRESS=C7@2000/10000,C6@7000/10000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+
+#define PRESS_MAX 8
+
+typedef struct press {
+	uint8_t port, mask;
+	uint64_t at, period, held;	// Cycles
+} press;
+
+static press presses[PRESS_MAX];
+static uint8_t press_count;
+
+static uint8_t press_pin_input(uint8_t port, uint8_t levels) {
+	uint64_t now = sim_cycles();
+	const press *p;
+	for (p = presses; p < presses + press_count; p++) {
+		if (p->port != port || now < p->at) {
+			continue;
+		}
+		if ((p->period ? (now - p->at) % p->period : now - p->at) < p->held) {
+			levels &= ~p->mask;
+		}
+	}
+	return levels;
+}
+
+static sim_device press_device = {
+	.pin_input = press_pin_input,
+};
+
+__attribute__((constructor)) static void press_attach(void) {
+	const char *spec = getenv("SIM_PRESS");
+	char port;
+	unsigned int bit;
+	unsigned long at, period, held;
+	int used;
+	if (!spec) {
+		return;
+	}
+	while (*spec && press_count < PRESS_MAX) {
+		period = 0;
+		held = 100;
+		if (sscanf(spec, "%c%u@%lu%n", &port, &bit, &at, &used) != 3 ||
+				port < 'A' || port > 'D' || bit > 7) {
+			fprintf(stderr, "press: can't read SIM_PRESS at \"%s\"\n", spec);
+			exit(1);
+		}
+		spec += used;
+		if (*spec == '/') {
+			period = strtoul(spec + 1, (char **)&spec, 10);
+		}
+		if (*spec == '+') {
+			held = strtoul(spec + 1, (char **)&spec, 10);
+		}
+		presses[press_count].port = SIM_PORT_A + (port - 'A');
+		presses[press_count].mask = 1 << bit;
+		presses[press_count].at = SIM_US(at * 1000);
+		presses[press_count].period = SIM_US(period * 1000);
+		presses[press_count].held = SIM_US(held * 1000);
+		press_count++;
+		spec += strspn(spec, ",");
+	}
+	sim_attach(&press_device);
+}
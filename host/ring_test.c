@@ -0,0 +1,165 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stress test of include/ring.h under preemption, for a PC. A POSIX
+// timer signal stands in for the interrupt: its handler runs on the one
+// thread between any two instructions of the main loop, as an AVR ISR
+// does, and runs to completion before the loop carries on. Two rings
+// are pushed and popped as fast as possible, one filled by the handler
+// and drained by the loop like the radio and UART receive queues, the
+// other filled by the loop and drained by the handler like the UART
+// transmit queue. The handler takes a burst of one to three elements
+// each time.
+//
+// Elements carry a sequence number and a check word written separately,
+// so a lost, repeated, reordered or half copied element shows up. The
+// sequence only advances on a successful push, so the consumer must see
+// every number once, in order. Options, from the environment:
+//  RING_TEST_MS   how long to run, 2000 by default
+//  RING_TEST_US   interval of the timer signal, 5 by default
+//
+// Exits non-zero on the first bad element.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ring.h"
+
+#define RING_TEST_SIZE 4		// Small, so it is full or empty often
+
+typedef struct element {
+	uint32_t seq;
+	uint32_t check;
+} element;
+
+RING_DECLARE(ring_in, element, RING_TEST_SIZE);	// Handler to loop
+RING_DECLARE(ring_out, element, RING_TEST_SIZE);	// Loop to handler
+
+typedef struct side {
+	uint32_t pushed, popped;	// Next sequence numbers
+	unsigned long full, empty;	// Pushes and pops turned away
+	unsigned long bad;
+} side;
+
+static side in, out;
+static volatile sig_atomic_t signals;
+static volatile sig_atomic_t draining;	// Handler only pops ring_out
+
+static uint32_t element_sum(uint32_t seq) {
+	return (seq ^ 0x5A5A5A5A) * 0x9E3779B9;
+}
+
+static void element_make(element *e, uint32_t seq) {
+	e->seq = seq;
+	e->check = element_sum(seq);
+}
+
+static void element_check(side *s, const element *e) {
+	if (e->seq != s->popped || e->check != element_sum(e->seq)) {
+		s->bad++;
+	}
+	s->popped = e->seq + 1;
+}
+
+static void ring_isr(int sig) {
+	element e;
+	uint8_t n = 1 + signals % 3;
+	(void)sig;
+	signals++;
+	while (n--) {
+		if (!draining) {
+			element_make(&e, in.pushed);
+			if (RING_PUSH(ring_in, e)) {
+				in.pushed++;
+			}
+			else {
+				in.full++;
+			}
+		}
+		if (RING_POP(ring_out, &e)) {
+			element_check(&out, &e);
+		}
+		else {
+			out.empty++;
+		}
+	}
+}
+
+static double ring_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(void) {
+	double ms = getenv("RING_TEST_MS") ? atof(getenv("RING_TEST_MS")) : 2000;
+	long us = getenv("RING_TEST_US") ? atol(getenv("RING_TEST_US")) : 5;
+	struct sigaction sa;
+	struct sigevent ev;
+	struct itimerspec its;
+	timer_t timer;
+	sigset_t block;
+	element e;
+	double end;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = ring_isr;
+	sigaction(SIGALRM, &sa, 0);
+	memset(&ev, 0, sizeof(ev));
+	ev.sigev_notify = SIGEV_SIGNAL;
+	ev.sigev_signo = SIGALRM;
+	if (timer_create(CLOCK_MONOTONIC, &ev, &timer)) {
+		perror("ring: timer_create");
+		return 2;
+	}
+	its.it_value.tv_sec = its.it_interval.tv_sec = 0;
+	its.it_value.tv_nsec = its.it_interval.tv_nsec = us * 1000;
+	timer_settime(timer, 0, &its, 0);
+
+	end = ring_now() + ms / 1000;
+	while (ring_now() < end && !in.bad && !out.bad) {
+		// Loop side: consumer of ring_in, producer of ring_out
+		if (RING_POP(ring_in, &e)) {
+			element_check(&in, &e);
+		}
+		else {
+			in.empty++;
+		}
+		element_make(&e, out.pushed);
+		if (RING_PUSH(ring_out, e)) {
+			out.pushed++;
+		}
+		else {
+			out.full++;
+		}
+	}
+
+	// Stop filling, let the handler drain ring_out, then take what is
+	// left in ring_in with the signal held off
+	draining = 1;
+	while (!RING_EMPTY(ring_out));
+	sigemptyset(&block);
+	sigaddset(&block, SIGALRM);
+	sigprocmask(SIG_BLOCK, &block, 0);
+	timer_delete(timer);
+	while (RING_POP(ring_in, &e)) {
+		element_check(&in, &e);
+	}
+
+	if (in.popped != in.pushed) {
+		in.bad++;
+	}
+	if (out.popped != out.pushed) {
+		out.bad++;
+	}
+	printf("ring: %lu interrupts in %.0f ms\n", (unsigned long)signals, ms);
+	printf("ring: interrupt to task %lu elements, %lu bad, full %lu, empty %lu\n",
+		(unsigned long)in.pushed, in.bad, in.full, in.empty);
+	printf("ring: task to interrupt %lu elements, %lu bad, full %lu, empty %lu\n",
+		(unsigned long)out.pushed, out.bad, out.full, out.empty);
+	return in.bad || out.bad;
+}
@@ -0,0 +1,604 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Simulated ATmega1284P, see sim.h
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <avr/io.h>
+
+// Simulated time between checks against the wall clock when paced
+#define SIM_PACE_CYCLES (F_CPU / 10000)
+
+// Vectors the firmware may define
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+void TIMER3_OVF_vect(void) __attribute__((weak));
+void USART1_RX_vect(void) __attribute__((weak));
+void USART1_UDRE_vect(void) __attribute__((weak));
+
+static volatile uint8_t sim_r8[SIM_REG8_COUNT];
+static volatile uint16_t sim_r16[SIM_REG16_COUNT];
+
+// Register values as last handed out, to spot what the firmware wrote
+static uint8_t sim_shadow[SIM_REG8_COUNT];
+
+static uint64_t sim_now = 0;		// Cycles since reset
+static uint64_t sim_end = 0;		// Cycle the run stops at
+static uint16_t sim_t1_frac = 0;	// Cycles into the current Timer1 count
+static uint16_t sim_t3_frac = 0;
+static uint64_t sim_adc_done = 0;	// Cycle the conversion finishes, 0 if idle
+static uint16_t sim_adc_value = 0;
+static uint8_t sim_in_isr = 0;
+static unsigned long sim_isr_count[5];
+// USART1
+static uint64_t sim_tx_done = 0;	// Cycle the frame being shifted out ends, 0 if idle
+static uint8_t sim_tx_buf, sim_tx_full;	// Byte waiting in UDR1 behind it
+static uint8_t sim_txc, sim_rxc;
+static uint8_t sim_rx_buf;
+static uint64_t sim_rx_at = 0;		// Next look at stdin, 0 if not listening
+static uint8_t sim_rx_eof;
+static uint8_t sim_udr_access;		// UDR1 handed out since the last sync
+static clock_t sim_host_start;
+static sim_device *sim_devices = 0;
+static uint64_t sim_device_at = 0;	// Cycle the next device poll is due
+static double sim_speed = 0;		// Simulated per wall clock second, 0 unpaced
+static uint64_t sim_pace_at = 0;
+static struct timespec sim_wall_start;
+static uint64_t sim_wdt_at = 0;	// Cycle the watchdog resets at, 0 if stopped
+
+// Bounds of the variables a reset leaves alone, set by the linker
+extern uint8_t __start_sim_noinit[] __attribute__((weak));
+extern uint8_t __stop_sim_noinit[] __attribute__((weak));
+extern uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_sim_eeprom[] __attribute__((weak));
+
+static const uint16_t sim_prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+static const uint8_t sim_pullup[4] = {
+	SIM_PULLUP_A, SIM_PULLUP_B, SIM_PULLUP_C, SIM_PULLUP_D
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Device models
+
+void sim_attach(sim_device *device) {
+	device->next = sim_devices;
+	sim_devices = device;
+}
+
+void sim_pace(double speed) {
+	sim_speed = speed;
+}
+
+uint8_t sim_ddr(uint8_t port) {
+	return sim_r8[SIM_DDRA + 3 * port];
+}
+
+static uint8_t sim_pin_input(uint8_t port, uint8_t levels) {
+	sim_device *d;
+	for (d = sim_devices; d; d = d->next) {
+		if (d->pin_input) {
+			levels = d->pin_input(port, levels);
+		}
+	}
+	return levels;
+}
+
+static void sim_pin_output(uint8_t port, uint8_t before, uint8_t after) {
+	sim_device *d;
+	for (d = sim_devices; d; d = d->next) {
+		if (d->pin_output) {
+			d->pin_output(port, before, after);
+		}
+	}
+}
+
+// Polls the devices that are due, and finds when the next one is
+static void sim_device_poll(void) {
+	sim_device *d;
+	sim_device_at = ~(uint64_t)0;
+	for (d = sim_devices; d; d = d->next) {
+		if (d->poll) {
+			if (d->poll_at <= sim_now) {
+				d->poll_at = d->poll(sim_now);
+			}
+			sim_device_at = d->poll_at < sim_device_at ? d->poll_at : sim_device_at;
+		}
+	}
+}
+
+// Default ADC input when no model replaces it
+__attribute__((weak)) uint16_t sim_adc_input(uint8_t channel) {
+	static int value = -1;
+	(void)channel;
+	if (value < 0) {
+		value = getenv("SIM_ADC") ? atoi(getenv("SIM_ADC")) & 0x3FF : 0;
+	}
+	return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+char *itoa(int value, char *s, int radix) {
+	char digits[sizeof(int) * 8 + 1];
+	unsigned int u = value < 0 && radix == 10 ? -value : (unsigned int)value;
+	int i = 0, j = 0;
+	if (value < 0 && radix == 10) {
+		s[j++] = '-';
+	}
+	do {
+		digits[i++] = "0123456789abcdefghijklmnopqrstuvwxyz"[u % radix];
+		u /= radix;
+	} while (u);
+	while (i) {
+		s[j++] = digits[--i];
+	}
+	s[j] = '\0';
+	return s;
+}
+
+uint64_t sim_cycles(void) {
+	return sim_now;
+}
+
+static void sim_report(void) {
+	double host = (double)(clock() - sim_host_start) / CLOCKS_PER_SEC;
+	double ms = sim_now * 1000.0 / F_CPU;
+	sim_device *d;
+	if (getenv("SIM_QUIET")) {
+		return;
+	}
+	fprintf(stderr, "sim: %.1f ms simulated in %.3f s host (%.0fx)\n",
+		ms, host, host > 0 ? ms / 1000.0 / host : 0.0);
+	fprintf(stderr, "sim: interrupts TIMER1_COMPA %lu, ADC %lu, USART1_RX %lu, USART1_UDRE %lu, "
+		"TIMER3_OVF %lu\n", sim_isr_count[0], sim_isr_count[1], sim_isr_count[3],
+		sim_isr_count[4], sim_isr_count[2]);
+	for (d = sim_devices; d; d = d->next) {
+		if (d->report) {
+			d->report();
+		}
+	}
+}
+
+static void sim_start(void) {
+	unsigned long ms = getenv("SIM_MS") ? strtoul(getenv("SIM_MS"), 0, 0) : 10000;
+	sim_end = (uint64_t)ms * (F_CPU / 1000);
+	if (getenv("SIM_SPEED")) {
+		sim_speed = atof(getenv("SIM_SPEED"));
+	}
+	// Out of reset UDR1 is empty
+	sim_r8[SIM_UCSR1A] = sim_shadow[SIM_UCSR1A] = 1 << UDRE1;
+	sim_host_start = clock();
+	clock_gettime(CLOCK_MONOTONIC, &sim_wall_start);
+	atexit(sim_report);
+}
+
+// Holds simulated time back to sim_speed times the wall clock
+static void sim_wait_wall(void) {
+	struct timespec now, wait;
+	double ahead;
+	sim_pace_at = sim_now + SIM_PACE_CYCLES;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ahead = (double)sim_now / F_CPU / sim_speed -
+		((now.tv_sec - sim_wall_start.tv_sec) +
+		(now.tv_nsec - sim_wall_start.tv_nsec) / 1e9);
+	if (ahead > 0) {
+		wait.tv_sec = (time_t)ahead;
+		wait.tv_nsec = (long)((ahead - wait.tv_sec) * 1e9);
+		nanosleep(&wait, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Watchdog. A reset execs the program again, handing over MCUSR, the
+// .noinit and EEPROM variables and the time left in SIM_RESET and
+// SIM_MS.
+
+// Cycles of the timeout WDTCSR selects, 2K to 1024K cycles of the
+// 128 kHz watchdog oscillator
+static uint64_t sim_wdt_period(void) {
+	uint8_t p = (sim_r8[SIM_WDTCSR] & (1 << WDP3) ? 8 : 0) | (sim_r8[SIM_WDTCSR] & 0x07);
+	return ((uint64_t)2048 << (p > 9 ? 9 : p)) * F_CPU / 128000;
+}
+
+static char *sim_hex(char *s, const uint8_t *from, const uint8_t *to) {
+	while (from < to) {
+		s += sprintf(s, "%02x", *from++);
+	}
+	return s;
+}
+
+static const char *sim_unhex(uint8_t *from, uint8_t *to, const char *s) {
+	unsigned int b;
+	while (from < to && sscanf(s, "%2x", &b) == 1) {
+		*from++ = b;
+		s += 2;
+	}
+	return s;
+}
+
+static void sim_wdt_reset(void) {
+	size_t size = (__stop_sim_noinit - __start_sim_noinit) + (__stop_sim_eeprom - __start_sim_eeprom);
+	char *state = malloc(2 * size + 2), *p;
+	char ms[24];
+	fprintf(stderr, "sim: watchdog reset at %.1f ms\n", sim_now * 1000.0 / F_CPU);
+	fflush(stdout);
+	if ((sim_end - sim_now) * 1000 / F_CPU == 0) {
+		exit(0);
+	}
+	snprintf(ms, sizeof(ms), "%llu", (unsigned long long)((sim_end - sim_now) * 1000 / F_CPU));
+	p = sim_hex(state, __start_sim_noinit, __stop_sim_noinit);
+	*p++ = ':';
+	sim_hex(p, __start_sim_eeprom, __stop_sim_eeprom);
+	setenv("SIM_MS", ms, 1);
+	setenv("SIM_RESET", state, 1);
+	execl("/proc/self/exe", "/proc/self/exe", (char *)0);
+	perror("sim: watchdog reset");
+	exit(1);
+}
+
+// Out of reset MCUSR tells a power-on from a watchdog reset. The
+// watchdog comes out of either stopped.
+__attribute__((constructor)) static void sim_resume(void) {
+	const char *state = getenv("SIM_RESET");
+	sim_r8[SIM_MCUSR] = sim_shadow[SIM_MCUSR] = 1 << PORF;
+	if (!state) {
+		return;
+	}
+	state = sim_unhex(__start_sim_noinit, __stop_sim_noinit, state);
+	if (*state == ':') {
+		sim_unhex(__start_sim_eeprom, __stop_sim_eeprom, state + 1);
+	}
+	sim_r8[SIM_MCUSR] = sim_shadow[SIM_MCUSR] = 1 << WDRF;
+	unsetenv("SIM_RESET");
+}
+
+void sim_wdr(void) {
+	sim_delay(1);
+	if (sim_wdt_at) {
+		sim_wdt_at = sim_now + sim_wdt_period();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Ports
+
+// Value PINx reads back for port p
+static uint8_t sim_pin_read(uint8_t p) {
+	uint8_t port = sim_r8[SIM_PORTA + 3 * p];
+	uint8_t ddr = sim_r8[SIM_DDRA + 3 * p];
+	// Inputs with PORTx set have the internal pull-up on
+	uint8_t floating = (port | sim_pullup[p]) & ~ddr;
+	return (port & ddr) | (sim_pin_input(p, floating) & ~ddr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// USART1
+
+// Cycles a 10 bit frame takes
+static uint64_t sim_uart_frame(void) {
+	return 10ULL * (sim_r8[SIM_UCSR1A] & (1 << U2X1) ? 8 : 16) * (sim_r16[SIM_UBRR1] + 1);
+}
+
+// Puts the status flags into UCSR1A, keeping the bits the firmware sets
+static void sim_uart_flags(void) {
+	sim_r8[SIM_UCSR1A] = (sim_r8[SIM_UCSR1A] & ((1 << U2X1) | (1 << MPCM1))) |
+		(sim_rxc << RXC1) | (sim_txc << TXC1) | (!sim_tx_full << UDRE1);
+	sim_shadow[SIM_UCSR1A] = sim_r8[SIM_UCSR1A];
+}
+
+static void sim_uart_out(uint8_t b) {
+	putchar(b);
+	fflush(stdout);
+}
+
+// Takes a byte off stdin if one is there
+static void sim_uart_in(void) {
+	struct pollfd fd = { .fd = 0, .events = POLLIN };
+	if (poll(&fd, 1, 0) == 1) {
+		if (read(0, &sim_rx_buf, 1) == 1) {
+			sim_rxc = 1;
+		}
+		else {
+			sim_rx_eof = 1;
+		}
+	}
+}
+
+// Moves USART1 on to now
+static void sim_uart_step(void) {
+	if (sim_tx_done && sim_now >= sim_tx_done) {
+		if (sim_tx_full) {
+			sim_uart_out(sim_tx_buf);
+			sim_tx_full = 0;
+			sim_tx_done += sim_uart_frame();
+		}
+		else {
+			sim_tx_done = 0;
+			sim_txc = 1;
+		}
+	}
+	if (sim_rx_at && sim_now >= sim_rx_at) {
+		// Held off while the last byte is unread rather than overrun
+		if (!sim_rxc) {
+			sim_uart_in();
+		}
+		sim_rx_at = (sim_r8[SIM_UCSR1B] & (1 << RXEN1)) && !sim_rx_eof ?
+			sim_now + sim_uart_frame() : 0;
+	}
+	sim_uart_flags();
+}
+
+// Handles what the firmware did to USART1 since the last sync
+static void sim_uart_sync(void) {
+	// TXC1 clears by writing a one to it
+	if (sim_r8[SIM_UCSR1A] != sim_shadow[SIM_UCSR1A] && (sim_r8[SIM_UCSR1A] & (1 << TXC1))) {
+		sim_txc = 0;
+	}
+	if (sim_udr_access) {
+		sim_udr_access = 0;
+		if (sim_r16[SIM_UDR1] & 0x100) {
+			sim_rxc = 0;
+		}
+		else if (sim_r8[SIM_UCSR1B] & (1 << TXEN1)) {
+			sim_txc = 0;
+			if (!sim_tx_done) {
+				sim_uart_out(sim_r16[SIM_UDR1]);
+				sim_tx_done = sim_now + sim_uart_frame();
+			}
+			else if (!sim_tx_full) {
+				sim_tx_buf = sim_r16[SIM_UDR1];
+				sim_tx_full = 1;
+			}
+		}
+	}
+	if ((sim_r8[SIM_UCSR1B] & (1 << RXEN1)) && !sim_rx_at && !sim_rx_eof) {
+		sim_rx_at = sim_now + sim_uart_frame();
+	}
+	sim_uart_flags();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Applies side effects of what the firmware wrote since the last access
+
+static void sim_sync(void) {
+	uint8_t p, r, before, after;
+	for (p = 0; p < 4; p++) {
+		r = SIM_PORTA + 3 * p;
+		// Writing ones to PINx toggles PORTx
+		if (sim_r8[r + 1] != sim_shadow[r + 1]) {
+			sim_r8[r] ^= sim_r8[r + 1];
+		}
+		if (sim_r8[r] != sim_shadow[r] || sim_r8[r + 2] != sim_shadow[r + 2]) {
+			before = sim_shadow[r] & sim_shadow[r + 2];
+			after = sim_r8[r] & sim_r8[r + 2];
+			sim_shadow[r] = sim_r8[r];
+			sim_shadow[r + 2] = sim_r8[r + 2];
+			sim_pin_output(p, before, after);
+		}
+	}
+	// Interrupt flags are cleared by writing a one
+	if (sim_r8[SIM_TIFR1] != sim_shadow[SIM_TIFR1]) {
+		sim_r8[SIM_TIFR1] = sim_shadow[SIM_TIFR1] & ~sim_r8[SIM_TIFR1];
+	}
+	if (sim_r8[SIM_TIFR3] != sim_shadow[SIM_TIFR3]) {
+		sim_r8[SIM_TIFR3] = sim_shadow[SIM_TIFR3] & ~sim_r8[SIM_TIFR3];
+	}
+	// Starting a conversion; the firmware always clears ADIF first
+	if ((sim_r8[SIM_ADCSRA] & (1 << ADSC)) && (sim_r8[SIM_ADCSRA] & (1 << ADEN)) &&
+			!sim_adc_done) {
+		uint8_t div = 1 << (sim_r8[SIM_ADCSRA] & 0x07);
+		sim_r8[SIM_ADCSRA] &= ~(1 << ADIF);
+		sim_adc_value = sim_adc_input(sim_r8[SIM_ADMUX] & 0x07);
+		sim_adc_done = sim_now + 13 * (div < 2 ? 2 : div);
+	}
+	sim_uart_sync();
+	// Enabling or changing the timeout restarts the count
+	if (sim_r8[SIM_WDTCSR] != sim_shadow[SIM_WDTCSR]) {
+		sim_wdt_at = sim_r8[SIM_WDTCSR] & (1 << WDE) ? sim_now + sim_wdt_period() : 0;
+	}
+	memcpy(sim_shadow, (const void *)sim_r8, sizeof(sim_shadow));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupts, highest priority (lowest vector number) first. Flags
+// cleared by the hardware are cleared in the shadow as well so they
+// don't look like a write.
+
+static void sim_call(void (*vector)(void), unsigned char n) {
+	sim_isr_count[n]++;
+	sim_in_isr = 1;
+	sim_r8[SIM_SREG] &= ~(1 << SREG_I);
+	sim_shadow[SIM_SREG] = sim_r8[SIM_SREG];
+	vector();
+	sim_sync();
+	sim_r8[SIM_SREG] |= 1 << SREG_I;
+	sim_shadow[SIM_SREG] = sim_r8[SIM_SREG];
+	sim_in_isr = 0;
+}
+
+static void sim_dispatch(void) {
+	while (!sim_in_isr && (sim_r8[SIM_SREG] & (1 << SREG_I))) {
+		if ((sim_r8[SIM_TIFR1] & sim_r8[SIM_TIMSK1] & (1 << OCF1A)) && TIMER1_COMPA_vect) {
+			sim_r8[SIM_TIFR1] = sim_shadow[SIM_TIFR1] &= ~(1 << OCF1A);
+			sim_call(TIMER1_COMPA_vect, 0);
+		}
+		else if ((sim_r8[SIM_ADCSRA] & (1 << ADIF)) && (sim_r8[SIM_ADCSRA] & (1 << ADIE)) &&
+				ADC_vect) {
+			sim_r8[SIM_ADCSRA] = sim_shadow[SIM_ADCSRA] &= ~(1 << ADIF);
+			sim_call(ADC_vect, 1);
+		}
+		else if ((sim_r8[SIM_UCSR1A] & (1 << RXC1)) && (sim_r8[SIM_UCSR1B] & (1 << RXCIE1)) &&
+				USART1_RX_vect) {
+			sim_call(USART1_RX_vect, 3);
+		}
+		else if ((sim_r8[SIM_UCSR1A] & (1 << UDRE1)) && (sim_r8[SIM_UCSR1B] & (1 << UDRIE1)) &&
+				USART1_UDRE_vect) {
+			sim_call(USART1_UDRE_vect, 4);
+		}
+		else if ((sim_r8[SIM_TIFR3] & sim_r8[SIM_TIMSK3] & (1 << TOV3)) && TIMER3_OVF_vect) {
+			sim_r8[SIM_TIFR3] = sim_shadow[SIM_TIFR3] &= ~(1 << TOV3);
+			sim_call(TIMER3_OVF_vect, 2);
+		}
+		else {
+			break;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Timers and ADC
+
+// Cycles until the next thing that sets an interrupt flag, or ~0. With
+// devices, until the next device poll as well.
+static uint64_t sim_next_event(uint8_t devices) {
+	uint64_t next = ~(uint64_t)0, t;
+	uint16_t pre1 = sim_prescale[sim_r8[SIM_TCCR1B] & 0x07];
+	uint16_t pre3 = sim_prescale[sim_r8[SIM_TCCR3B] & 0x07];
+	uint32_t counts;
+	if (pre1) {
+		if (sim_r8[SIM_TCCR1B] & (1 << WGM12)) {
+			counts = (uint32_t)(uint16_t)(sim_r16[SIM_OCR1A] - sim_r16[SIM_TCNT1]) + 1;
+		}
+		else {
+			counts = 0x10000 - sim_r16[SIM_TCNT1];
+		}
+		t = (uint64_t)counts * pre1 - sim_t1_frac;
+		next = t < next ? t : next;
+	}
+	if (pre3) {
+		t = (uint64_t)(0x10000 - sim_r16[SIM_TCNT3]) * pre3 - sim_t3_frac;
+		next = t < next ? t : next;
+	}
+	if (sim_adc_done) {
+		t = sim_adc_done > sim_now ? sim_adc_done - sim_now : 0;
+		next = t < next ? t : next;
+	}
+	if (sim_tx_done) {
+		t = sim_tx_done > sim_now ? sim_tx_done - sim_now : 0;
+		next = t < next ? t : next;
+	}
+	if (sim_rx_at) {
+		t = sim_rx_at > sim_now ? sim_rx_at - sim_now : 0;
+		next = t < next ? t : next;
+	}
+	if (sim_wdt_at) {
+		t = sim_wdt_at > sim_now ? sim_wdt_at - sim_now : 0;
+		next = t < next ? t : next;
+	}
+	if (devices && sim_device_at != ~(uint64_t)0) {
+		t = sim_device_at > sim_now ? sim_device_at - sim_now : 0;
+		next = t < next ? t : next;
+	}
+	return next;
+}
+
+// Moves the peripherals on by cycles, no further than the next event
+static void sim_step(uint64_t cycles) {
+	uint16_t pre1 = sim_prescale[sim_r8[SIM_TCCR1B] & 0x07];
+	uint16_t pre3 = sim_prescale[sim_r8[SIM_TCCR3B] & 0x07];
+	uint32_t counts, total, left;
+	sim_now += cycles;
+	if (pre1) {
+		total = sim_t1_frac + cycles;
+		counts = total / pre1;
+		sim_t1_frac = total % pre1;
+		// Clears on the count after matching OCR1A, setting the flag
+		// at the same time. Steps never span more than one clear.
+		left = (uint32_t)(uint16_t)(sim_r16[SIM_OCR1A] - sim_r16[SIM_TCNT1]) + 1;
+		if ((sim_r8[SIM_TCCR1B] & (1 << WGM12)) && counts >= left) {
+			sim_r16[SIM_TCNT1] = counts - left;
+			sim_r8[SIM_TIFR1] |= 1 << OCF1A;
+		}
+		else {
+			sim_r16[SIM_TCNT1] += counts;
+		}
+	}
+	if (pre3) {
+		total = sim_t3_frac + cycles;
+		counts = total / pre3;
+		sim_t3_frac = total % pre3;
+		if (sim_r16[SIM_TCNT3] + counts > 0xFFFF) {
+			sim_r8[SIM_TIFR3] |= 1 << TOV3;
+		}
+		sim_r16[SIM_TCNT3] += counts;
+	}
+	if (sim_adc_done && sim_now >= sim_adc_done) {
+		sim_adc_done = 0;
+		sim_r16[SIM_ADC] = sim_adc_value;
+		sim_r8[SIM_ADCSRA] = (sim_r8[SIM_ADCSRA] & ~(1 << ADSC)) | (1 << ADIF);
+	}
+	sim_uart_step();
+	sim_shadow[SIM_TIFR1] = sim_r8[SIM_TIFR1];
+	sim_shadow[SIM_TIFR3] = sim_r8[SIM_TIFR3];
+	sim_shadow[SIM_ADCSRA] = sim_r8[SIM_ADCSRA];
+}
+
+void sim_delay(unsigned long cycles) {
+	uint64_t left = cycles, next;
+	if (!sim_end) {
+		sim_start();
+	}
+	sim_sync();
+	while (left) {
+		next = sim_next_event(1);
+		next = next == 0 ? 1 : next;
+		next = next < left ? next : left;
+		sim_step(next);
+		left -= next;
+		if (sim_wdt_at && sim_now >= sim_wdt_at) {
+			sim_wdt_reset();
+		}
+		if (sim_now >= sim_device_at) {
+			sim_device_poll();
+		}
+		if (sim_speed > 0 && sim_now >= sim_pace_at) {
+			sim_wait_wall();
+		}
+		sim_dispatch();
+		if (sim_now >= sim_end) {
+			exit(0);
+		}
+	}
+	sim_dispatch();
+}
+
+void sim_sleep(void) {
+	uint64_t next;
+	sim_sync();
+	sim_dispatch();
+	if (!(sim_r8[SIM_SREG] & (1 << SREG_I))) {
+		fprintf(stderr, "sim: sleep with interrupts disabled never wakes\n");
+		exit(1);
+	}
+	// Device polls don't wake the CPU, only interrupts do
+	next = sim_next_event(0);
+	if (next == ~(uint64_t)0) {
+		fprintf(stderr, "sim: sleep with nothing to wake the CPU\n");
+		exit(1);
+	}
+	sim_delay(next ? next : 1);
+}
+
+volatile uint8_t *sim_io8(uint8_t reg) {
+	sim_delay(SIM_IO_CYCLES);
+	if (reg == SIM_PINA || reg == SIM_PINB || reg == SIM_PINC || reg == SIM_PIND) {
+		sim_r8[reg] = sim_shadow[reg] = sim_pin_read((reg - SIM_PINA) / 3);
+	}
+	return &sim_r8[reg];
+}
+
+volatile uint16_t *sim_io16(uint8_t reg) {
+	sim_delay(SIM_IO_CYCLES);
+	if (reg == SIM_UDR1) {
+		sim_r16[SIM_UDR1] = 0x100 | sim_rx_buf;
+		sim_udr_access = 1;
+	}
+	return &sim_r16[reg];
+}
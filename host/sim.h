@@ -0,0 +1,144 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Simulated ATmega1284P for running a firmware natively on the host.
+// Built by `make host`, which puts this directory ahead of the avr-libc
+// headers. Modelled:
+//  - ports A to D, with PINx read back from PORTx/DDRx and whatever the
+//    attached device models drive onto input pins
+//  - Timer1 in CTC or normal mode and Timer3 in normal mode, with their
+//    compare, overflow flags and interrupts
+//  - the ADC with its conversion time, fed by the sim_adc_input() hook
+//  - USART1 transmitting to stdout and receiving from stdin, one frame
+//    time per byte at the baud rate UBRR1 and U2X1 set, with its RX and
+//    UDRE interrupts. UDR1 is 16 bits wide here so a write can be told
+//    from a read: reads have bit 8 set, so read it into a uint8_t.
+//  - SREG's I bit, cli/sei, ATOMIC_BLOCK and idle sleep
+//  - the watchdog in system reset mode, stopped out of reset. A reset
+//    starts the program over through exec with MCUSR's WDRF set,
+//    SIM_NOINIT variables and the EEMEM ones as they were, and SIM_MS
+//    counting on from where it was. Reports at exit cover the time
+//    since the latest reset.
+//
+// Simulated time only moves at register accesses (SIM_IO_CYCLES each),
+// delays and sleep, so pure computation is free. Vectors run between
+// register accesses once their flag is set and interrupts are on. By
+// default it runs as fast as the host allows; SIM_SPEED holds it to a
+// multiple of the wall clock, for firmwares talking to each other
+// through device models in separate processes.
+// int is 32 bits here, code that relies on 16 bit overflow behaves
+// differently.
+//
+// Run time options, from the environment:
+//  SIM_MS       simulated ms to run before exiting, 10000 by default
+//  SIM_ADC      value every ADC channel converts to, 0 by default
+//  SIM_SPEED    simulated seconds per wall clock second, 0 for unpaced
+//  SIM_QUIET    set to skip the summary printed at exit
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+// Cycles charged for each register access
+#ifndef SIM_IO_CYCLES
+#define SIM_IO_CYCLES 2
+#endif
+
+// Pins pulled up by external resistors on the board, per port. A
+// firmware's Makefile sets these for its board, e.g. the 1-Wire bus.
+#ifndef SIM_PULLUP_A
+#define SIM_PULLUP_A 0
+#endif
+#ifndef SIM_PULLUP_B
+#define SIM_PULLUP_B 0
+#endif
+#ifndef SIM_PULLUP_C
+#define SIM_PULLUP_C 0
+#endif
+#ifndef SIM_PULLUP_D
+#define SIM_PULLUP_D 0
+#endif
+
+enum sim_reg8 {
+	SIM_PORTA, SIM_PINA, SIM_DDRA,
+	SIM_PORTB, SIM_PINB, SIM_DDRB,
+	SIM_PORTC, SIM_PINC, SIM_DDRC,
+	SIM_PORTD, SIM_PIND, SIM_DDRD,
+	SIM_ADCSRA, SIM_ADCSRB, SIM_ADMUX, SIM_DIDR0,
+	SIM_SREG,
+	SIM_TCCR1A, SIM_TCCR1B, SIM_TIMSK1, SIM_TIFR1,
+	SIM_TCCR3A, SIM_TCCR3B, SIM_TIMSK3, SIM_TIFR3,
+	SIM_MCUSR, SIM_SMCR, SIM_GPIOR0, SIM_GPIOR1, SIM_GPIOR2,
+	SIM_UCSR1A, SIM_UCSR1B, SIM_UCSR1C, SIM_WDTCSR,
+	SIM_REG8_COUNT
+};
+
+enum sim_reg16 {
+	SIM_ADC, SIM_OCR1A, SIM_TCNT1, SIM_TCNT3, SIM_UBRR1, SIM_UDR1,
+	SIM_REG16_COUNT
+};
+
+// Ports in hook arguments
+enum sim_port { SIM_PORT_A, SIM_PORT_B, SIM_PORT_C, SIM_PORT_D };
+
+#define SIM_R8(r)  (*sim_io8(r))
+#define SIM_R16(r) (*sim_io16(r))
+
+volatile uint8_t *sim_io8(uint8_t reg);
+volatile uint16_t *sim_io16(uint8_t reg);
+
+// Passes cycles of simulated time, running interrupts as they fall due
+void sim_delay(unsigned long cycles);
+// Idle sleep: passes time up to the next event that can wake the CPU
+void sim_sleep(void);
+// Cycles since reset
+uint64_t sim_cycles(void);
+// Sets the default pace, overridden by SIM_SPEED
+void sim_pace(double speed);
+// wdr
+void sim_wdr(void);
+
+// Variables a reset leaves alone, the .noinit section on the AVR
+#define SIM_NOINIT __attribute__((section("sim_noinit")))
+
+#define SIM_US(us) ((uint64_t)(us) * (F_CPU / 1000000UL))
+
+////////////////////////////////////////////////////////////////////////////////
+// Device models. A model fills in the callbacks it needs, leaving the
+// others 0, and attaches itself from a constructor:
+//
+//     static sim_device radio = { .pin_output = ..., .poll = ... };
+//     __attribute__((constructor)) static void radio_attach(void) {
+//         sim_attach(&radio);
+//     }
+
+typedef struct sim_device {
+	// Levels on the input pins of port, given the levels from the
+	// pull-ups and the other devices. Returns them with the bits this
+	// device drives changed.
+	uint8_t (*pin_input)(uint8_t port, uint8_t levels);
+	// Called after PORTx or DDRx of port changed, with the old and new
+	// output levels (PORTx & DDRx)
+	void (*pin_output)(uint8_t port, uint8_t before, uint8_t after);
+	// Called once simulated time reaches poll_at. Returns the cycle to
+	// be called again at, ~0 for never.
+	uint64_t (*poll)(uint64_t now);
+	// Prints the device's summary at exit
+	void (*report)(void);
+	uint64_t poll_at;
+	struct sim_device *next;
+} sim_device;
+
+void sim_attach(sim_device *device);
+// DDRx of port, for models that have to tell a pin driven low from a
+// released one, such as a slave on an open drain bus
+uint8_t sim_ddr(uint8_t port);
+
+// 10 bit result of a conversion on channel. Weak in sim.c, a model
+// linked in replaces the SIM_ADC default.
+uint16_t sim_adc_input(uint8_t channel);
+
+#endif
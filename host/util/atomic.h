@@ -0,0 +1,23 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+// Host stand-in for <util/atomic.h>, the same SREG save, cli and
+// restore as avr-libc's, through the simulated SREG
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+
+static inline uint8_t sim_atomic_cli(void) { cli(); return 1; }
+static inline void sim_atomic_restore(const uint8_t *sreg) { SREG = *sreg; }
+static inline void sim_atomic_on(const uint8_t *sreg) { (void)sreg; sei(); }
+
+#define ATOMIC_BLOCK(type) for (type, sim_todo = sim_atomic_cli(); \
+	sim_todo; sim_todo = 0)
+#define ATOMIC_RESTORESTATE uint8_t sim_sreg \
+	__attribute__((__cleanup__(sim_atomic_restore))) = SREG
+#define ATOMIC_FORCEON uint8_t sim_sreg \
+	__attribute__((__cleanup__(sim_atomic_on))) = 0
+
+#endif
@@ -0,0 +1,14 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+// Host stand-in for <util/delay.h>, the delay passes in simulated time
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "sim.h"
+
+#define _delay_us(us) sim_delay((unsigned long)((us) * (F_CPU / 1e6) + 0.5))
+#define _delay_ms(ms) sim_delay((unsigned long)((ms) * (F_CPU / 1e3) + 0.5))
+
+#endif
@@ -3,28 +3,146 @@
 #define ADC_H
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+#include <util/atomic.h>
 
+// Pins on PORTA sampled by the ADC, in round-robin order.
+// Values range between 0 and 7, where the value represents the pin
+// on PORTA. Pins not in the list are left alone so they can still be
+// used for digital I/O (the nRF24 sits on PORTA as well).
+#ifndef ADC_CHANNEL_LIST
+#define ADC_CHANNEL_LIST    { 0 }
+#endif
+
+// Extra bits of resolution gained by oversampling. Each published
+// sample is the sum of 4^n conversions shifted right by n.
+#ifndef ADC_OVERSAMPLE_BITS
+#define ADC_OVERSAMPLE_BITS 2
+#endif
+
+// Number of decimated samples averaged into the filtered value.
+// Must be a power of two, and small enough that their sum fits the
+// 16 bit adc_sum at ADC_BITS.
+#ifndef ADC_RING_SIZE
+#define ADC_RING_SIZE       4
+#endif
+
+#define ADC_BITS            (10 + ADC_OVERSAMPLE_BITS)
+#define ADC_SAMPLES         (1 << (2 * ADC_OVERSAMPLE_BITS))
+#define ADC_RING_SHIFT      __builtin_ctz(ADC_RING_SIZE)
+_Static_assert(ADC_RING_SIZE > 0 && (ADC_RING_SIZE & (ADC_RING_SIZE - 1)) == 0,
+               "ADC_RING_SIZE must be a power of two");
+_Static_assert(((uint32_t)ADC_RING_SIZE << ADC_BITS) <= 0x10000UL,
+               "ADC_RING_SIZE samples of ADC_BITS overflow adc_sum");
+
+// ADC clock prescaler: the smallest division that keeps the ADC clock
+// at or under 200 kHz, needed for full 10 bit accuracy
+#if F_CPU <= 200000UL * 16
+#define ADC_PRESCALE_BITS ((1 << ADPS2))
+#elif F_CPU <= 200000UL * 32
+#define ADC_PRESCALE_BITS ((1 << ADPS2) | (1 << ADPS0))
+#elif F_CPU <= 200000UL * 64
+#define ADC_PRESCALE_BITS ((1 << ADPS2) | (1 << ADPS1))
+#else
+#define ADC_PRESCALE_BITS ((1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0))
+#endif
+_Static_assert(F_CPU <= 200000UL * 128, "ADC clock can't be brought under 200 kHz");
+
+static const uint8_t adc_channels[] = ADC_CHANNEL_LIST;
+#define ADC_CHANNELS (sizeof(adc_channels) / sizeof(adc_channels[0]))
+
+/* Sampler state, only touched by the conversion complete ISR */
+static uint8_t  adc_index;                        // position in adc_channels
+static uint8_t  adc_count;                        // conversions in adc_acc
+static uint32_t adc_acc;                          // oversampling accumulator
+static uint16_t adc_ring[ADC_CHANNELS][ADC_RING_SIZE];
+static uint8_t  adc_head[ADC_CHANNELS];
+static uint16_t adc_sum[ADC_CHANNELS];            // running sum of adc_ring
+
+/* Published values, read through adc_read() */
+static volatile uint16_t adc_value[ADC_CHANNELS];
+static volatile uint8_t  adc_primed;              // every ring filled once
+
+static inline void adc_select(uint8_t pinNum) {
+    // Keep the reference selection bits, replace the channel
+    ADMUX = (ADMUX & 0xE0) | (pinNum & 0x07);
+}
+
+// Handles one finished conversion: accumulates it, decimates once
+// enough samples are in, then moves the mux on to the next channel.
+// The mux is latched when a conversion starts, so switching here gives
+// the channel a full sample and hold period to settle.
+static void adc_sample(void) {
+    adc_acc += ADC;
+    if (++adc_count == ADC_SAMPLES) {
+        uint16_t sample = adc_acc >> ADC_OVERSAMPLE_BITS;
+        uint8_t  head = adc_head[adc_index];
+
+        adc_sum[adc_index] -= adc_ring[adc_index][head];
+        adc_sum[adc_index] += sample;
+        adc_ring[adc_index][head] = sample;
+        adc_head[adc_index] = (head + 1) & (ADC_RING_SIZE - 1);
+        adc_value[adc_index] = adc_sum[adc_index] >> ADC_RING_SHIFT;
+
+        adc_acc = 0;
+        adc_count = 0;
+        if (++adc_index == ADC_CHANNELS) {
+            adc_index = 0;
+            if (adc_head[0] == 0) {
+                adc_primed = 1;
+            }
+        }
+        adc_select(adc_channels[adc_index]);
+    }
+    ADCSRA |= (1 << ADSC);
+}
+
+ISR(ADC_vect) {
+    adc_sample();
+}
 
 void adc_init(void) {
+    adc_select(adc_channels[0]);
     // ADEN: Enables ADC
-    // ADSC: Starts ADC
-    // ADATE: Enables auto-triggering. Allowing for constant conversion
-    ADCSRA |= (1 << ADEN) | (1 << ADSC) | (1 << ADATE);
+    // ADIE: Interrupt on conversion complete
+    // ADPS2:0: prescaler from F_CPU, /64 or 125 kHz ADC clock at 8 MHz
+    // Conversions are started one at a time from the ISR so the mux
+    // can be switched between them.
+    ADCSRA = (1 << ADEN) | (1 << ADIE) | ADC_PRESCALE_BITS;
+    ADCSRA |= (1 << ADSC);
+    sei();
+    // Don't publish half-filled averages to the first reader. Sleep
+    // between conversions, each one's interrupt wakes the CPU.
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    while (!adc_primed) {
+        sleep_cpu();
+    }
+    sleep_disable();
 }
 
-// Pins on PORTA are used as input for A2D conversion
-// The default channel is 0 (PA0)
-// The value of pinNum determines the pin on PORTA
-// used for A2D conversion
-// Valid values range between 0 and 7, where the value
-// represents the desired pin for A2D conversion
-void adc_set_pin(unsigned char pinNum) {
-	ADMUX = (pinNum <= 0x07) ? pinNum : ADMUX;
-	// Allow channel to stabilize
-	static unsigned char i = 0;
-	for ( i=0; i<20; i++ ) {
-		asm("nop");
-	}
+// Returns the filtered value for the pin on PORTA, scaled to ADC_BITS.
+// Never touches the ADC hardware, except when called with interrupts
+// masked (e.g. inside an ATOMIC_BLOCK) where a finished conversion is
+// handled in place so values keep updating.
+uint16_t adc_read(uint8_t pinNum) {
+    uint8_t i;
+    uint16_t value = 0;
+    if (!(SREG & (1 << SREG_I)) && (ADCSRA & (1 << ADIF))) {
+        ADCSRA |= (1 << ADIF);
+        adc_sample();
+    }
+    for (i = 0; i < ADC_CHANNELS; i++) {
+        if (adc_channels[i] == pinNum) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                value = adc_value[i];
+            }
+            break;
+        }
+    }
+    return value;
 }
 
 #endif
@@ -0,0 +1,48 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// Cycle benchmark markers. Built with -DBENCH (make bench), each marker
+// is a single `out` to GPIOR0, which nothing else uses: the id to begin
+// a region and id | BENCH_END_BIT to end it. The simavr harness in
+// ../bench watches that register and times every region to the cycle.
+// Without BENCH the markers compile to nothing.
+//
+// Regions may nest, and an interrupt taken inside a region is counted
+// in it, so max is the worst case the code actually saw.
+
+// Marker list: name and id, 1 to 127. The harness reads its names
+// from here as well.
+#define BENCH_MARKERS(X) \
+	X(TIMER_ISR,   1)	/* Timer1 compare ISR, entry to exit */ \
+	X(TICK,        2)	/* One release pass, TimerISR() when ticked */ \
+	X(TASK,        3)	/* One task tick function */ \
+	X(SPI,         4)	/* spi_transfer() of one byte */ \
+	X(THERM_READ,  5)	/* therm_read_temperature() */ \
+	X(LCD_STRING,  6)	/* LCD_DisplayString() */ \
+	X(DISPLAY,     7)	/* update_display() */
+
+#define BENCH_END_BIT 0x80
+
+#define BENCH_ENUM(name, id) BENCH_##name = id,
+enum bench_marker { BENCH_MARKERS(BENCH_ENUM) };
+#undef BENCH_ENUM
+
+#ifndef BENCH_HOST
+#include <avr/io.h>
+
+#ifdef BENCH
+#define BENCH_BEGIN(m) (GPIOR0 = BENCH_##m)
+#define BENCH_END(m)   (GPIOR0 = BENCH_##m | BENCH_END_BIT)
+#else
+#define BENCH_BEGIN(m) ((void)0)
+#define BENCH_END(m)   ((void)0)
+#endif
+
+#endif //BENCH_HOST
+
+#endif //BENCH_H
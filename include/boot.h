@@ -0,0 +1,81 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include "clock.h"
+
+// Boot profile: when each phase of start-up finished, in us since
+// ClockOn(). The firmware lists its phases before including this file,
+// in the order they finish on a normal boot,
+//     #define BOOT_PHASES(X) X(RADIO) X(SCHEDULER) X(READY)
+// and marks each with BootMark(). Only the first mark of a phase
+// counts, so marks can sit in code that runs again later. Times wrap
+// after 71 minutes like ClockUs().
+//
+// What comes before ClockOn() isn't counted: the reset start-up delay,
+// setting up .data and .bss and the stack painting of stack.h, which
+// takes about 10 ms at 8 MHz.
+//
+// Building with BOOT_FAST has a firmware start the scheduler as soon as
+// the hardware its tasks need is set up and leave slow initialisation
+// to tasks, so commands are taken while it finishes.
+
+#define BOOT_ENUM(name) BOOT_##name,
+enum boot_phase { BOOT_PHASES(BOOT_ENUM) BOOT_COUNT };
+#undef BOOT_ENUM
+_Static_assert(BOOT_COUNT <= 16, "at most 16 boot phases");
+
+#define BOOT_NAME(name) static const char boot_name_##name[] PROGMEM = #name;
+BOOT_PHASES(BOOT_NAME)
+#undef BOOT_NAME
+#define BOOT_NAME(name) boot_name_##name,
+static const char * const boot_names[BOOT_COUNT] PROGMEM = { BOOT_PHASES(BOOT_NAME) };
+#undef BOOT_NAME
+
+unsigned long boot_us[BOOT_COUNT];
+uint16_t boot_marked;			// Bit per phase reached
+
+#ifdef SIM_H
+#include <stdio.h>
+#include <stdlib.h>
+
+static void boot_print(void) {
+	uint8_t p;
+	fprintf(stderr, "boot:");
+	for (p = 0; p < BOOT_COUNT; p++) {
+		if (boot_marked & (1U << p)) {
+			fprintf(stderr, " %s %.1f", boot_names[p], boot_us[p] / 1000.0);
+		}
+	}
+	fprintf(stderr, " ms\n");
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Notes that phase has finished, unless it already has
+void BootMark(uint8_t phase) {
+	if (boot_marked & (1U << phase)) {
+		return;
+	}
+#ifdef SIM_H
+	if (!boot_marked) {
+		atexit(boot_print);
+	}
+#endif
+	boot_us[phase] = ClockUs();
+	boot_marked |= 1U << phase;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Non-zero once phase has been marked
+uint8_t BootDone(uint8_t phase) {
+	return (boot_marked & (1U << phase)) != 0;
+}
+
+#endif //BOOT_H
@@ -0,0 +1,74 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <avr/io.h>
+
+// CPU clock in Hz. Set once for the whole build from the Makefile
+// (make F_CPU=16000000UL); every prescaler, compare value and delay is
+// derived from it below or through util/delay.h.
+#ifndef F_CPU
+#error "F_CPU is not set, build through the Makefile or pass -DF_CPU"
+#endif
+
+// Timer1 prescaler: the coarsest of /64, /8 and /1 that still counts a
+// whole number of times per ms, so the 1 ms tick is exact
+#if F_CPU % 64000 == 0
+#define CLOCK_T1_PRESCALE 64
+#define CLOCK_T1_CS       ((1<<CS11)|(1<<CS10))
+#elif F_CPU % 8000 == 0
+#define CLOCK_T1_PRESCALE 8
+#define CLOCK_T1_CS       (1<<CS11)
+#else
+#define CLOCK_T1_PRESCALE 1
+#define CLOCK_T1_CS       (1<<CS10)
+#endif
+// Timer1 counts per ms
+#define CLOCK_COUNTS_MS   (F_CPU / CLOCK_T1_PRESCALE / 1000)
+
+// Timer3 runs free at /8 as the cycle counter
+#define CLOCK_T3_PRESCALE 8
+#define CLOCK_T3_CS       (1<<CS31)
+#define CLOCK_CYCLE_COUNTS_MS (F_CPU / CLOCK_T3_PRESCALE / 1000)
+
+_Static_assert(F_CPU % (CLOCK_T1_PRESCALE * 1000UL) == 0, "F_CPU must be a whole number of kHz");
+_Static_assert(CLOCK_COUNTS_MS >= 2 && CLOCK_COUNTS_MS <= 0x7FFF, "Timer1 can't time 1 ms at this F_CPU");
+_Static_assert(F_CPU % (CLOCK_T3_PRESCALE * 1000UL) == 0, "F_CPU must be a multiple of 8 kHz for the cycle counter");
+
+// Monotonic time since ClockOn(), kept by the Timer1 compare interrupt
+// that also drives the scheduler. The functions are defined in
+// scheduler.h so they are available to every file of a firmware that
+// includes it once, drivers included.
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Starts Timer1 and the Timer3 cycle counter and enables
+//interrupts. TimerOn() calls it if main() hasn't already.
+void ClockOn();
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Milliseconds since ClockOn(), read atomically
+unsigned long ClockMs();
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Microseconds since ClockOn(), the millisecond count
+//combined with TCNT1. Resolution is one Timer1 count, 8 us at 8 MHz
+//and 0.4 us at 20 MHz, and it wraps after about 71 minutes.
+unsigned long ClockUs();
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Timeout helpers. start is an earlier ClockMs() or
+//ClockUs() reading; differences stay correct across wrap.
+//Returns: Non-zero once at least ms (us) have passed since start
+unsigned char ClockExpired(unsigned long start, unsigned long ms);
+unsigned char ClockExpiredUs(unsigned long start, unsigned long us);
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Busy waits, needs interrupts enabled
+void ClockDelayMs(unsigned int ms);
+void ClockDelayUs(unsigned int us);
+
+#endif //CLOCK_H
@@ -0,0 +1,356 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uart.h"
+
+// Line console on the UART, for looking at and tuning a running
+// firmware from a terminal at UART_BAUD. Commands and tunables are
+// listed before including this file as (with the lines continued by
+// backslashes)
+//     #define CONSOLE_COMMANDS(X)
+//         X(stats, console_stats, "task statistics")
+//     #define CONSOLE_TUNABLES(X)
+//         X(open_fast, _open_wait_fast, 100, 2000)
+// where a tunable is an integer variable of one or two bytes and the
+// limits are what set accepts. help, get and set are always there.
+//
+// A command handler is
+//     uint8_t handler(uint8_t argc, char **argv, uint8_t row)
+// with argv[0] the command. It is called with row 0, then with the next
+// row for as long as it returns CONSOLE_MORE, or with the same row on
+// the next ConsoleTick() if it returns CONSOLE_WAIT. Each call is made
+// only once CONSOLE_ROOM bytes are free to send and may write up to
+// that many, so long output goes out a row at a time and the console
+// never waits on the line or holds up the other tasks. Input waits in
+// the receive ring while a command runs.
+//
+// ConsoleTick() is called from a task; all the work happens there.
+
+#ifndef CONSOLE_COMMANDS
+#define CONSOLE_COMMANDS(X)
+#endif
+#ifndef CONSOLE_TUNABLES
+#define CONSOLE_TUNABLES(X)
+#endif
+
+#define CONSOLE_LINE   32	// Longest command line
+#define CONSOLE_ARGS   4	// Words in a command line
+#define CONSOLE_ROOM   64	// Output a handler may write per call
+#define CONSOLE_PROMPT "> "
+_Static_assert(CONSOLE_ROOM <= UART_TX_SIZE, "CONSOLE_ROOM must fit the transmit ring");
+
+// Handler results
+#define CONSOLE_DONE   0
+#define CONSOLE_MORE   1
+#define CONSOLE_WAIT   2
+
+#define CONSOLE_NONE   0xFF	// No command running
+
+typedef uint8_t (*console_handler)(uint8_t argc, char **argv, uint8_t row);
+
+typedef struct console_command {
+	const char *name;		// In flash
+	const char *help;		// In flash
+	console_handler handler;
+} console_command;
+
+typedef struct console_tunable {
+	const char *name;		// In flash
+	void *var;
+	uint8_t size;			// 1 or 2 bytes
+	uint8_t is_signed;
+	long min, max;
+} console_tunable;
+
+uint8_t console_help(uint8_t argc, char **argv, uint8_t row);
+uint8_t console_get(uint8_t argc, char **argv, uint8_t row);
+uint8_t console_set(uint8_t argc, char **argv, uint8_t row);
+
+#define CONSOLE_BUILTINS(X) \
+	X(help, console_help, "this list") \
+	X(get,  console_get,  "[name]: tunables and their limits") \
+	X(set,  console_set,  "name value: change a tunable")
+
+#define CONSOLE_PROTO(name, fn, help) uint8_t fn(uint8_t argc, char **argv, uint8_t row);
+#define CONSOLE_STRINGS(name, fn, help) \
+	static const char console_name_##name[] PROGMEM = #name; \
+	static const char console_help_##name[] PROGMEM = help;
+#define CONSOLE_ENTRY(name, fn, help) { console_name_##name, console_help_##name, fn },
+CONSOLE_COMMANDS(CONSOLE_PROTO)
+CONSOLE_BUILTINS(CONSOLE_STRINGS)
+CONSOLE_COMMANDS(CONSOLE_STRINGS)
+static const console_command console_commands[] PROGMEM = {
+	CONSOLE_BUILTINS(CONSOLE_ENTRY)
+	CONSOLE_COMMANDS(CONSOLE_ENTRY)
+};
+#define CONSOLE_COMMAND_COUNT (sizeof(console_commands) / sizeof(console_commands[0]))
+
+#define CONSOLE_TUNABLE_NAME(name, var, lo, hi) \
+	_Static_assert(sizeof(var) <= 2, #var " is too wide for a tunable"); \
+	static const char console_tunable_##name[] PROGMEM = #name;
+#define CONSOLE_TUNABLE_ENTRY(name, var, lo, hi) \
+	{ console_tunable_##name, &(var), sizeof(var), (__typeof__(var))-1 < 0, lo, hi },
+CONSOLE_TUNABLES(CONSOLE_TUNABLE_NAME)
+static const console_tunable console_tunables[] PROGMEM = {
+	CONSOLE_TUNABLES(CONSOLE_TUNABLE_ENTRY)
+};
+#define CONSOLE_TUNABLE_COUNT (sizeof(console_tunables) / sizeof(console_tunables[0]))
+
+static char console_line[CONSOLE_LINE];
+static uint8_t console_len;
+static char console_last;		// Previous input character
+static char *console_argv[CONSOLE_ARGS];
+static uint8_t console_argc;
+static uint8_t console_cmd = CONSOLE_NONE;
+static uint8_t console_row;
+
+////////////////////////////////////////////////////////////////////////////////
+// Output. Handlers stay within CONSOLE_ROOM, anything past the free
+// space is dropped.
+
+void ConsolePut(char c) {
+	UartPut(c);
+}
+
+//Functionality - Writes a string from RAM
+void ConsolePuts(const char *s) {
+	while (*s) {
+		UartPut(*s++);
+	}
+}
+
+//Functionality - Writes a string from flash, e.g. ConsolePutsP(PSTR("ok"))
+void ConsolePutsP(const char *s) {
+	char c;
+	while ((c = pgm_read_byte(s++))) {
+		UartPut(c);
+	}
+}
+
+//Functionality - Writes v in decimal
+void ConsolePutU(unsigned long v) {
+	char digits[10];
+	uint8_t n = 0;
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n) {
+		UartPut(digits[--n]);
+	}
+}
+
+//Functionality - Writes v in decimal, with a sign if negative
+void ConsolePutI(long v) {
+	if (v < 0) {
+		UartPut('-');
+		ConsolePutU(-(unsigned long)v);
+	}
+	else {
+		ConsolePutU(v);
+	}
+}
+
+//Functionality - Ends a line
+void ConsoleEnd() {
+	UartPut('\r');
+	UartPut('\n');
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Reads a whole decimal or 0x hex number
+//Returns: 0 if s isn't one
+uint8_t ConsoleNumber(const char *s, long *v) {
+	char *end;
+	*v = strtol(s, &end, 0);
+	return *s && !*end;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tunables
+
+static long console_tunable_get(const console_tunable *t) {
+	if (t->size == 1) {
+		return t->is_signed ? *(int8_t *)t->var : *(uint8_t *)t->var;
+	}
+	return t->is_signed ? *(int16_t *)t->var : *(uint16_t *)t->var;
+}
+
+static void console_tunable_set(const console_tunable *t, long v) {
+	if (t->size == 1) {
+		*(uint8_t *)t->var = v;
+	}
+	else {
+		*(uint16_t *)t->var = v;
+	}
+}
+
+// Index of the tunable called name, CONSOLE_NONE if there is none
+static uint8_t console_tunable_find(const char *name) {
+	uint8_t i;
+	for (i = 0; i < CONSOLE_TUNABLE_COUNT; i++) {
+		if (!strcmp_P(name, (const char *)pgm_read_ptr(&console_tunables[i].name))) {
+			return i;
+		}
+	}
+	return CONSOLE_NONE;
+}
+
+static void console_tunable_print(uint8_t i) {
+	console_tunable t;
+	memcpy_P(&t, &console_tunables[i], sizeof(t));
+	ConsolePutsP(t.name);
+	ConsolePut(' ');
+	ConsolePutI(console_tunable_get(&t));
+	ConsolePutsP(PSTR(" ("));
+	ConsolePutI(t.min);
+	ConsolePutsP(PSTR(" to "));
+	ConsolePutI(t.max);
+	ConsolePut(')');
+	ConsoleEnd();
+}
+
+uint8_t console_help(uint8_t argc, char **argv, uint8_t row) {
+	(void)argc; (void)argv;
+	if (row >= CONSOLE_COMMAND_COUNT) {
+		return CONSOLE_DONE;
+	}
+	ConsolePutsP((const char *)pgm_read_ptr(&console_commands[row].name));
+	ConsolePut(' ');
+	ConsolePutsP((const char *)pgm_read_ptr(&console_commands[row].help));
+	ConsoleEnd();
+	return CONSOLE_MORE;
+}
+
+uint8_t console_get(uint8_t argc, char **argv, uint8_t row) {
+	uint8_t i;
+	if (argc > 1) {
+		i = console_tunable_find(argv[1]);
+		if (i == CONSOLE_NONE) {
+			ConsolePutsP(PSTR("no such tunable"));
+			ConsoleEnd();
+		}
+		else {
+			console_tunable_print(i);
+		}
+		return CONSOLE_DONE;
+	}
+	if (row >= CONSOLE_TUNABLE_COUNT) {
+		return CONSOLE_DONE;
+	}
+	console_tunable_print(row);
+	return CONSOLE_MORE;
+}
+
+uint8_t console_set(uint8_t argc, char **argv, uint8_t row) {
+	console_tunable t;
+	uint8_t i;
+	long v;
+	(void)row;
+	i = argc == 3 ? console_tunable_find(argv[1]) : CONSOLE_NONE;
+	if (i == CONSOLE_NONE) {
+		ConsolePutsP(PSTR("set name value"));
+		ConsoleEnd();
+		return CONSOLE_DONE;
+	}
+	memcpy_P(&t, &console_tunables[i], sizeof(t));
+	if (!ConsoleNumber(argv[2], &v) || v < t.min || v > t.max) {
+		ConsolePutsP(PSTR("out of range "));
+	}
+	else {
+		console_tunable_set(&t, v);
+	}
+	console_tunable_print(i);
+	return CONSOLE_DONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Splits the line into words and starts the command it names
+static void console_start() {
+	char *p = console_line;
+	uint8_t i;
+	console_line[console_len] = 0;
+	console_len = 0;
+	console_argc = 0;
+	while (*p && console_argc < CONSOLE_ARGS) {
+		while (*p == ' ') {
+			*p++ = 0;
+		}
+		if (*p) {
+			console_argv[console_argc++] = p;
+		}
+		while (*p && *p != ' ') {
+			p++;
+		}
+	}
+	if (!console_argc) {
+		ConsolePutsP(PSTR(CONSOLE_PROMPT));
+		return;
+	}
+	for (i = 0; i < CONSOLE_COMMAND_COUNT; i++) {
+		if (!strcmp_P(console_argv[0], (const char *)pgm_read_ptr(&console_commands[i].name))) {
+			console_cmd = i;
+			console_row = 0;
+			return;
+		}
+	}
+	ConsolePutsP(PSTR("unknown command, try help"));
+	ConsoleEnd();
+	ConsolePutsP(PSTR(CONSOLE_PROMPT));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Reads what has come in and moves the running command
+//along as far as the transmit ring allows. Returns without waiting.
+void ConsoleTick() {
+	console_handler handler;
+	uint8_t c, result;
+	while (1) {
+		if (console_cmd != CONSOLE_NONE) {
+			if (UartFree() < CONSOLE_ROOM) {
+				return;
+			}
+			handler = (console_handler)pgm_read_ptr(&console_commands[console_cmd].handler);
+			result = handler(console_argc, console_argv, console_row);
+			if (result == CONSOLE_WAIT) {
+				return;
+			}
+			if (result == CONSOLE_MORE) {
+				console_row++;
+				continue;
+			}
+			console_cmd = CONSOLE_NONE;
+			ConsolePutsP(PSTR(CONSOLE_PROMPT));
+		}
+		// Echo needs up to three bytes
+		if (UartFree() < 3 || !UartGet(&c)) {
+			return;
+		}
+		if (c == '\r' || (c == '\n' && console_last != '\r')) {
+			ConsoleEnd();
+			console_start();
+		}
+		else if (c == '\b' || c == 0x7F) {
+			if (console_len) {
+				console_len--;
+				ConsolePutsP(PSTR("\b \b"));
+			}
+		}
+		else if (c >= ' ' && console_len < CONSOLE_LINE - 1) {
+			console_line[console_len++] = c;
+			ConsolePut(c);
+		}
+		console_last = c;
+	}
+}
+
+#endif //CONSOLE_H
@@ -0,0 +1,100 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DELAY_H
+#define DELAY_H
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include "clock.h"
+
+// Two kinds of delay, neither of which depends on how the compiler
+// happens to lay out a loop:
+//  - DELAY_US(n) for compile time constants, counted to the cycle by
+//    util/delay.h from F_CPU. Use it for bus timing such as 1-Wire slots.
+//  - DelayUs(n) for values known only at run time, e.g. a stepper ramp.
+//    It waits on the free-running Timer3 started by ClockOn(), so it
+//    is accurate to one count (8 cycles) plus the time spent in
+//    interrupts, which it doesn't add on top of like a loop would.
+#define DELAY_US(n) _delay_us(n)
+
+// Timer3 counts for us microseconds
+#define DELAY_COUNTS(us) ((unsigned long)(us) * CLOCK_CYCLE_COUNTS_MS / 1000)
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Waits at least us microseconds, needs ClockOn()
+static inline void DelayUs(unsigned int us) {
+	unsigned long counts = DELAY_COUNTS(us);
+	uint16_t start = TCNT3;
+	// Wait in halves of the counter range so a wrap can't be missed.
+	// Counts are taken modulo 16 bits like the counter, also on a host
+	// with a wider int.
+	while (counts > 0x8000) {
+		while ((uint16_t)(TCNT3 - start) < 0x8000);
+		start += 0x8000;
+		counts -= 0x8000;
+	}
+	while ((uint16_t)(TCNT3 - start) < (uint16_t)counts);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Self test: times each delay against Timer3 with interrupts off. None
+// is longer than 2 ms, so the 1 ms tick has at most one compare match
+// pending and keeps time.
+typedef struct delay_result {
+	unsigned int requested;		//us asked for
+	unsigned long measured;		//CPU cycles taken, +-8
+	unsigned long expected;		//CPU cycles asked for
+} delay_result;
+
+#define DELAY_CHECK_COUNT 10
+// Worst error DelayCheck() should find: a Timer3 count for the delay's
+// own resolution, one for the measurement and one for call overhead
+#define DELAY_CHECK_LIMIT (3 * CLOCK_T3_PRESCALE)
+
+// Runs one delay between two Timer3 reads, whose own few cycles are
+// within the measurement resolution
+#define DELAY_MEASURE(r, us, call) do { \
+	uint16_t t0, t1; \
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { \
+		t0 = TCNT3; \
+		call; \
+		t1 = TCNT3; \
+	} \
+	(r)->requested = (us); \
+	(r)->measured = (unsigned long)(uint16_t)(t1 - t0) * CLOCK_T3_PRESCALE; \
+	(r)->expected = (unsigned long)(us) * (F_CPU / 1000000UL); \
+	(r)++; \
+} while (0)
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Measures the 1-Wire slot delays and a spread of run
+//time delays, filling DELAY_CHECK_COUNT results.
+//Returns: The largest difference in cycles between measured and expected
+static inline unsigned long DelayCheck(delay_result *results) {
+	delay_result *r = results;
+	unsigned long worst = 0, error;
+	unsigned char i;
+	DELAY_MEASURE(r, 1, DELAY_US(1));
+	DELAY_MEASURE(r, 14, DELAY_US(14));
+	DELAY_MEASURE(r, 45, DELAY_US(45));
+	DELAY_MEASURE(r, 60, DELAY_US(60));
+	DELAY_MEASURE(r, 480, DELAY_US(480));
+	DELAY_MEASURE(r, 50, DelayUs(50));
+	DELAY_MEASURE(r, 300, DelayUs(300));
+	DELAY_MEASURE(r, 700, DelayUs(700));
+	DELAY_MEASURE(r, 1000, DelayUs(1000));
+	DELAY_MEASURE(r, 1500, DelayUs(1500));
+	for (i = 0; i < DELAY_CHECK_COUNT; i++) {
+		error = results[i].measured > results[i].expected ?
+			results[i].measured - results[i].expected :
+			results[i].expected - results[i].measured;
+		worst = error > worst ? error : worst;
+	}
+	return worst;
+}
+
+#endif //DELAY_H
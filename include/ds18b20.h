@@ -8,15 +8,12 @@
 #include <avr/io.h>
 #include <stdint.h>
 
-#define F_CPU         8000000UL // Clock speed at 8MHz
-#define LOOP_CYCLES   8         // Number of cycles the loop costs
-#define us(num)       (num/(LOOP_CYCLES*(1/(F_CPU/1000000.0))))
+#include "delay.h"
+#include "pin.h"
 
-/* Thermometer Connections (At your choice) */
-#define THERM_PORT PORTB
-#define THERM_DDR  DDRB
-#define THERM_PIN  PINB
-#define THERM_DQ   PB0
+/* Thermometer Connections (At your choice), selected by the pin argument */
+#define THERM_DQ0  B, 0
+#define THERM_DQ1  B, 1
 
 /* Commands */
 #define THERM_CMD_CONVERTTEMP      0x44
@@ -31,14 +28,19 @@
 #define THERM_CMD_SKIPROM      	   0xcc
 #define THERM_CMD_ALARMSEARCH      0xec
 
-/* Utils */
-#define THERM_INPUT_MODE(pin)  THERM_DDR &= ~(1 << pin)
-#define THERM_OUTPUT_MODE(pin) THERM_DDR |= (1 << pin)
-#define THERM_LOW(pin)         THERM_PORT &= ~(1 << pin)
-#define THERM_HIGH(pin)        THERM_PORT |= (1 << pin)
+/* Utils. Each bus is a compile time pin so every access is one sbi/cbi */
+#define THERM_BUS(pin, op)     ((pin) ? op(THERM_DQ1) : op(THERM_DQ0))
+#define THERM_INPUT_MODE(pin)  THERM_BUS(pin, PIN_INPUT)
+#define THERM_OUTPUT_MODE(pin) THERM_BUS(pin, PIN_OUTPUT)
+#define THERM_LOW(pin)         THERM_BUS(pin, PIN_LOW)
+#define THERM_HIGH(pin)        THERM_BUS(pin, PIN_HIGH)
+#define THERM_READ(pin)        THERM_BUS(pin, PIN_READ)
 #define THERM_DECIMAL_STEPS_12BIT   625
+// Longest 12 bit conversion is 750 ms
+#define THERM_CONVERT_MS            1000
 
-void therm_delay(uint16_t delay);
+// Zero if a sensor answered the reset with a presence pulse
+uint8_t therm_reset(uint8_t pin);
 
 void therm_write_bit(uint8_t bit, uint8_t pin);
 
@@ -48,6 +50,13 @@ uint8_t therm_read_byte(uint8_t pin);
 
 void therm_write_byte(uint8_t byte, uint8_t pin);
 
+// Zero if a sensor answered and started converting
+uint8_t therm_convert(uint8_t pin);
+
+uint8_t therm_converted(uint8_t pin);
+
+int8_t therm_read_result(uint8_t pin);
+
 int8_t therm_read_temperature(uint8_t pin);
 
 #endif
@@ -0,0 +1,178 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <avr/io.h>
+#include <stdint.h>
+#include "clock.h"
+
+// Command latency, from a button on the remote to the first motor step
+// on the window. Each node marks its own points on its own ClockUs()
+// and folds the time between consecutive ones into a histogram per
+// point. The remote numbers its commands and sends the sequence number
+// with each one, along with how long its half took, so the window can
+// account for the whole path and a trace on either side can be matched
+// to the other.
+//
+// Both halves start at a poll: the button poll on the remote and the
+// radio poll on the window. Neither node can tell when the press or
+// the packet actually came between two polls, so a trace starts at the
+// last poll that found nothing, and the first segment is an upper
+// bound on the wait. The total the window records is then an upper
+// bound on press to step, short of the time on the air, which the
+// remote's ACKED segment shows.
+//
+// The histograms stay in RAM for a debugger or a console to read. The
+// host build prints every trace as it ends and the histograms at exit.
+
+// Points of both nodes in path order, name and index
+#define LATENCY_POINTS(X) \
+	X(RELEASED,   0)	/* remote: last button poll that saw none */ \
+	X(PRESSED,    1)	/* remote: tick_btn() sees the button */ \
+	X(SENT,       2)	/* remote: the command goes to the radio */ \
+	X(ACKED,      3)	/* remote: send_rx() returns */ \
+	X(EMPTY,      4)	/* window: last radio poll that found none */ \
+	X(RECEIVED,   5)	/* window: radio_poll() takes the command */ \
+	X(DISPATCHED, 6)	/* window: tick_nrf() acts on it */ \
+	X(STEPPED,    7)	/* window: first step pulse */
+
+#define LATENCY_ENUM(name, i) LATENCY_##name = i,
+enum latency_point { LATENCY_POINTS(LATENCY_ENUM) LATENCY_TOTAL };
+#undef LATENCY_ENUM
+
+// Bucket 0 counts segments under 1 ms, bucket b from 2^(b-1) ms up to
+// 2^b ms, and the last one everything longer
+#define LATENCY_BUCKETS 10
+
+// Histogram of the segment ending at each point, and of whole traces
+uint16_t latency_hist[LATENCY_TOTAL + 1][LATENCY_BUCKETS];
+unsigned long latency_max[LATENCY_TOTAL + 1];	// us
+
+static unsigned long latency_idle;		// Last poll that found nothing
+static unsigned long latency_at[LATENCY_TOTAL];	// Points of the current trace
+static unsigned long latency_extra;		// us spent before this node
+static uint8_t latency_seq;
+static uint8_t latency_last = LATENCY_TOTAL;	// Last point marked, TOTAL when idle
+static uint8_t latency_first;
+
+#ifdef SIM_H
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LATENCY_NAME(name, i) #name,
+static const char *latency_names[] = { LATENCY_POINTS(LATENCY_NAME) "total" };
+#undef LATENCY_NAME
+
+static void latency_print(void) {
+	uint8_t p, b;
+	for (p = 0; p <= LATENCY_TOTAL; p++) {
+		if (!latency_max[p] && !latency_hist[p][0]) {
+			continue;
+		}
+		fprintf(stderr, "latency: %-10s max %7.1f ms, by ms <1 <2 <4 .. >=256:",
+			latency_names[p], latency_max[p] / 1000.0);
+		for (b = 0; b < LATENCY_BUCKETS; b++) {
+			fprintf(stderr, " %u", latency_hist[p][b]);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+#endif
+
+static void latency_add(uint8_t point, unsigned long us) {
+	unsigned long ms = us / 1000;
+	uint8_t b = 0;
+	while (ms && b < LATENCY_BUCKETS - 1) {
+		ms >>= 1;
+		b++;
+	}
+	if (latency_hist[point][b] != 0xFFFF) {
+		latency_hist[point][b]++;
+	}
+	if (us > latency_max[point]) {
+		latency_max[point] = us;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Notes a poll that found nothing to do, where the next
+//trace will start
+void LatencyIdle() {
+	latency_idle = ClockUs();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Starts the trace of command seq at the last idle poll,
+//recorded as point first. extra_us is the time the command spent before
+//reaching this node. Replaces any trace still running.
+void LatencyBegin(uint8_t seq, uint8_t first, unsigned long extra_us) {
+#ifdef SIM_H
+	static uint8_t registered;
+	if (!registered) {
+		registered = atexit(latency_print) == 0;
+	}
+#endif
+	latency_seq = seq;
+	latency_first = latency_last = first;
+	latency_at[first] = latency_idle;
+	latency_extra = extra_us;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Marks point of the running trace, if there is one
+void LatencyMark(uint8_t point) {
+	if (latency_last == LATENCY_TOTAL) {
+		return;
+	}
+	latency_at[point] = ClockUs();
+	latency_add(point, latency_at[point] - latency_at[latency_last]);
+	latency_last = point;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - ms since the running trace started, saturated to a byte
+//for sending along with the command
+uint8_t LatencyMs() {
+	unsigned long ms = (ClockUs() - latency_at[latency_first]) / 1000;
+	return ms > 0xFF ? 0xFF : ms;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Ends the running trace at the last point marked
+void LatencyEnd() {
+	unsigned long total;
+	if (latency_last == LATENCY_TOTAL) {
+		return;
+	}
+	total = latency_at[latency_last] - latency_at[latency_first] + latency_extra;
+	latency_add(LATENCY_TOTAL, total);
+#ifdef SIM_H
+	{
+		uint8_t p;
+		fprintf(stderr, "latency: seq %u", latency_seq);
+		for (p = latency_first + 1; p <= latency_last; p++) {
+			fprintf(stderr, " %s +%.1f", latency_names[p],
+				(latency_at[p] - latency_at[p - 1]) / 1000.0);
+		}
+		fprintf(stderr, " total %.1f ms", total / 1000.0);
+		if (latency_extra) {
+			fprintf(stderr, " (%.0f before)", latency_extra / 1000.0);
+		}
+		fprintf(stderr, "\n");
+	}
+#endif
+	latency_last = LATENCY_TOTAL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Drops the running trace, for a command that didn't get
+//as far as the last point
+void LatencyCancel() {
+	latency_last = LATENCY_TOTAL;
+}
+
+#endif //LATENCY_H
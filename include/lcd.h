@@ -5,37 +5,33 @@
 #define LCD_H
 
 #include <stdio.h>
-
-#define SET_BIT(p,i) ((p) |= (1 << (i)))
-#define CLR_BIT(p,i) ((p) &= ~(1 << (i)))
-#define GET_BIT(p,i) ((p) & (1 << (i)))
+#include <util/delay.h>
+#include "bench.h"
+#include "clock.h"
+#include "pin.h"
 
 /*-------------------------------------------------------------------------*/
 
 #define DATA_BUS PORTD		// port connected to pins 7-14 of LCD display
-#define CONTROL_BUS PORTC	// port connected to pins 4 and 6 of LCD disp.
-#define RS 1				// pin number of uC connected to pin 4 of LCD disp.
-#define E 0					// pin number of uC connected to pin 6 of LCD disp.
+#define RS C, 1				// pin of uC connected to pin 4 of LCD disp.
+#define E C, 0				// pin of uC connected to pin 6 of LCD disp.
+#define LCD_E_US 0.5		// enable pulse width, 450 ns minimum
+#define LCD_POWER_UP_MS 100	// from power on to the first command
 
 /*-------------------------------------------------------------------------*/
 
-void delay_ms(int miliSec) { //for 8 Mhz crystal
-	int i,j;
-	for(i=0;i<miliSec;i++) {
-		for(j=0;j<775;j++) {
-			asm("nop");
-		}
-	}
+void delay_ms(int miliSec) { // needs ClockOn()
+	ClockDelayMs(miliSec);
 }
 
 /*-------------------------------------------------------------------------*/
 
 void LCD_WriteCommand (unsigned char Command) {
-	CLR_BIT(CONTROL_BUS,RS);
+	PIN_LOW(RS);
 	DATA_BUS = Command;
-	SET_BIT(CONTROL_BUS,E);
-	asm("nop");
-	CLR_BIT(CONTROL_BUS,E);
+	PIN_HIGH(E);
+	_delay_us(LCD_E_US);
+	PIN_LOW(E);
 	delay_ms(3); // ClearScreen requires 1.52ms to execute
 }
 
@@ -43,8 +39,8 @@ void LCD_ClearScreen(void) {
 	LCD_WriteCommand(0x01);
 }
 
-void LCD_init(void) {
-	delay_ms(100); //wait for 100 ms for LCD to power up
+// Set up of the controller, once it has had LCD_POWER_UP_MS since power on
+void LCD_Start(void) {
 	LCD_WriteCommand(0x38);
 	LCD_WriteCommand(0x06);
 	LCD_WriteCommand(0x0f);
@@ -52,12 +48,17 @@ void LCD_init(void) {
 	delay_ms(10);
 }
 
+void LCD_init(void) {
+	delay_ms(LCD_POWER_UP_MS); //wait for LCD to power up
+	LCD_Start();
+}
+
 void LCD_WriteData(unsigned char Data) {
-	SET_BIT(CONTROL_BUS,RS);
+	PIN_HIGH(RS);
 	DATA_BUS = Data;
-	SET_BIT(CONTROL_BUS,E);
-	asm("nop");
-	CLR_BIT(CONTROL_BUS,E);
+	PIN_HIGH(E);
+	_delay_us(LCD_E_US);
+	PIN_LOW(E);
 	delay_ms(1);
 }
 
@@ -72,10 +73,12 @@ void LCD_Cursor(unsigned char column) {
 void LCD_DisplayString( unsigned char column, const unsigned char* string) {
 	//LCD_ClearScreen();
 	unsigned char c = column;
+	BENCH_BEGIN(LCD_STRING);
 	while(*string) {
 		LCD_Cursor(c++);
 		LCD_WriteData(*string++);
 	}
+	BENCH_END(LCD_STRING);
 }
 
 #endif // LCD_H
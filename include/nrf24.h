@@ -66,51 +66,38 @@ void    nrf24_readRegister(uint8_t reg, uint8_t* value, uint8_t len);
 void    nrf24_writeRegister(uint8_t reg, uint8_t* value, uint8_t len);
 
 /* -------------------------------------------------------------------------- */
-/* You should implement the platform spesific functions in your code */
+/* Platform specific pins. Each firmware names its radio pins in its own   */
+/* nrf_pins.h as pin.h descriptors, e.g. #define NRF_CE A, 1, for NRF_CE,   */
+/* NRF_CSN, NRF_SCK, NRF_MOSI and NRF_MISO. These resolve to single         */
+/* sbi/cbi/sbic instructions, nrf24.c includes nrf_pins.h.                  */
 /* -------------------------------------------------------------------------- */
+#include "pin.h"
 
 /* -------------------------------------------------------------------------- */
-/* In this function you should do the following things:
- *    - Set MISO pin input
- *    - Set MOSI pin output
- *    - Set SCK pin output
- *    - Set CSN pin output
- *    - Set CE pin output     */
+/* Sets MISO pin input, MOSI, SCK, CSN and CE pins output                     */
 /* -------------------------------------------------------------------------- */
-extern void nrf24_setupPins();
+#define nrf24_setupPins() do { \
+        PIN_OUTPUT(NRF_CE); \
+        PIN_OUTPUT(NRF_CSN); \
+        PIN_OUTPUT(NRF_SCK); \
+        PIN_OUTPUT(NRF_MOSI); \
+        PIN_INPUT(NRF_MISO); \
+    } while (0)
 
 /* -------------------------------------------------------------------------- */
-/* nrf24 CE pin control function
+/* nrf24 pin control
  *    - state:1 => Pin HIGH
  *    - state:0 => Pin LOW     */
 /* -------------------------------------------------------------------------- */
-extern void nrf24_ce_digitalWrite(uint8_t state);
+#define nrf24_ce_digitalWrite(state)   PIN_WRITE(NRF_CE, state)
+#define nrf24_csn_digitalWrite(state)  PIN_WRITE(NRF_CSN, state)
+#define nrf24_sck_digitalWrite(state)  PIN_WRITE(NRF_SCK, state)
+#define nrf24_mosi_digitalWrite(state) PIN_WRITE(NRF_MOSI, state)
 
 /* -------------------------------------------------------------------------- */
-/* nrf24 CE pin control function
- *    - state:1 => Pin HIGH
- *    - state:0 => Pin LOW     */
-/* -------------------------------------------------------------------------- */
-extern void nrf24_csn_digitalWrite(uint8_t state);
-
-/* -------------------------------------------------------------------------- */
-/* nrf24 SCK pin control function
- *    - state:1 => Pin HIGH
- *    - state:0 => Pin LOW     */
-/* -------------------------------------------------------------------------- */
-extern void nrf24_sck_digitalWrite(uint8_t state);
-
-/* -------------------------------------------------------------------------- */
-/* nrf24 MOSI pin control function
- *    - state:1 => Pin HIGH
- *    - state:0 => Pin LOW     */
-/* -------------------------------------------------------------------------- */
-extern void nrf24_mosi_digitalWrite(uint8_t state);
-
-/* -------------------------------------------------------------------------- */
-/* nrf24 MISO pin read function
-/* - returns: Non-zero if the pin is high */
+/* nrf24 MISO pin read
+ * - returns: Non-zero if the pin is high */
 /* -------------------------------------------------------------------------- */
-extern uint8_t nrf24_miso_digitalRead();
+#define nrf24_miso_digitalRead()       PIN_READ(NRF_MISO)
 
 #endif
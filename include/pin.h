@@ -0,0 +1,38 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PIN_H
+#define PIN_H
+
+#include <avr/io.h>
+
+// Compile time pin descriptors. A pin is named once as its port letter
+// and bit,
+//     #define STEP_PIN C, 0
+// and the macros below paste that into PORTC/PINC/DDRC with a constant
+// mask, so with optimization each access is a single sbi, cbi, sbis or
+// sbic on ports A to D instead of a read-modify-write of a copy.
+
+#define PIN_HIGH(pin)       PIN_HIGH_(pin)
+#define PIN_LOW(pin)        PIN_LOW_(pin)
+#define PIN_TOGGLE(pin)     PIN_TOGGLE_(pin)
+#define PIN_OUTPUT(pin)     PIN_OUTPUT_(pin)
+#define PIN_INPUT(pin)      PIN_INPUT_(pin)
+// Non-zero if the pin reads high
+#define PIN_READ(pin)       PIN_READ_(pin)
+// Drives the pin to value; a constant value folds to one instruction
+#define PIN_WRITE(pin, value) PIN_WRITE_(pin, value)
+
+// Second level so a descriptor macro expands into its two arguments
+#define PIN_HIGH_(p, b)     (PORT##p |= (1 << (b)))
+#define PIN_LOW_(p, b)      (PORT##p &= ~(1 << (b)))
+// Writing a one to PINx toggles the output latch
+#define PIN_TOGGLE_(p, b)   (PIN##p = (1 << (b)))
+#define PIN_OUTPUT_(p, b)   (DDR##p |= (1 << (b)))
+#define PIN_INPUT_(p, b)    (DDR##p &= ~(1 << (b)))
+#define PIN_READ_(p, b)     (PIN##p & (1 << (b)))
+#define PIN_WRITE_(p, b, value) ((value) ? PIN_HIGH_(p, b) : PIN_LOW_(p, b))
+
+#endif //PIN_H
@@ -0,0 +1,68 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+// Single producer, single consumer ring buffer of any element type,
+// safe between an interrupt and a task without disabling interrupts.
+//
+//     RING_DECLARE(_rx_queue, radio_packet, 4);
+//     if (!RING_PUSH(_rx_queue, packet)) ...     // producer side
+//     while (RING_POP(_rx_queue, &packet)) ...   // consumer side
+//
+// head is only written by the producer and tail only by the consumer.
+// Both are single bytes, so reads and writes of them are atomic on the
+// AVR, and they run freely modulo 256 so a full ring is told apart from
+// an empty one without a spare slot. That needs the capacity to be a
+// power of two no larger than 128. An element is written before head
+// moves past it and read before tail does, with a compiler barrier in
+// between so the store of the index can't be hoisted above the copy.
+// host/ring_test.c checks that under preemption, `make ring-test` in
+// window/.
+
+#define RING_DECLARE(name, type, size) \
+	_Static_assert((size) >= 2 && (size) <= 128 && ((size) & ((size) - 1)) == 0, \
+		#name " size must be a power of two from 2 to 128"); \
+	static struct { \
+		type buf[size]; \
+		volatile uint8_t head;	/* next slot to write, producer only */ \
+		volatile uint8_t tail;	/* next slot to read, consumer only */ \
+	} name
+
+#define RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+#define RING_SIZE(r)  ((uint8_t)(sizeof((r).buf) / sizeof((r).buf[0])))
+#define RING_COUNT(r) ((uint8_t)((r).head - (r).tail))
+#define RING_EMPTY(r) ((r).head == (r).tail)
+#define RING_FULL(r)  (RING_COUNT(r) == RING_SIZE(r))
+
+// Copies v in. Returns 0 and leaves the ring alone if it is full.
+#define RING_PUSH(r, v) ({ \
+	uint8_t ring_h = (r).head; \
+	uint8_t ring_ok = (uint8_t)(ring_h - (r).tail) < RING_SIZE(r); \
+	if (ring_ok) { \
+		(r).buf[ring_h & (RING_SIZE(r) - 1)] = (v); \
+		RING_BARRIER(); \
+		(r).head = ring_h + 1; \
+	} \
+	ring_ok; \
+})
+
+// Copies the oldest element to *out. Returns 0 if the ring is empty.
+#define RING_POP(r, out) ({ \
+	uint8_t ring_t = (r).tail; \
+	uint8_t ring_ok = (r).head != ring_t; \
+	if (ring_ok) { \
+		*(out) = (r).buf[ring_t & (RING_SIZE(r) - 1)]; \
+		RING_BARRIER(); \
+		(r).tail = ring_t + 1; \
+	} \
+	ring_ok; \
+})
+
+#endif //RING_H
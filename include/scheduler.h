@@ -1,5 +1,4 @@
-
-// Permission to copy is granted provided that this header remains intact. 
+// Permission to copy is granted provided that this header remains intact.
 // This software is provided with no warranties.
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -10,71 +9,821 @@
 #define __AVR_ATmega1284__
 
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <string.h>
+#include <util/atomic.h>
+#include "bench.h"
+#include "clock.h"
+#include "trace.h"
+
+// Tasks are declared before including this file as a table of
+//     X(tick function, initial state, period in ms, phase in ms)
+// entries, e.g. (with a backslash ending all but the last line)
+//     #define TASK_TABLE(X)
+//         X(tick_temp, TEMP_GET, 3000, 0)
+//         X(tick_nrf,  NRF_SEND, 100,  50)
+// and instantiated with TASKS_DEFINE() once the initial states are
+// declared. The tick GCD and the counter widths are worked out at
+// compile time and the table itself lives in flash. A task is first
+// released phase ms after the first tick, then every period.
+//
+// Define SCHED_PHASE_SLOTS > 1 to have TimerOn() pick phases itself:
+// the tick is split into that many slots and every task with a zero
+// phase is placed where it adds least to the busiest tick.
+#ifndef TASK_TABLE
+#error "Define TASK_TABLE before including scheduler.h"
+#endif
+
+// Define SCHED_TICKLESS before including this file to use the tickless
+// variant: instead of a 1 ms interrupt scanning every task, tasks are
+// kept in a list ordered by next deadline and Timer1 is programmed to
+// fire only when the nearest one is due.
+
+// Timer1 counts per ms, 125 at 8 MHz / 64, see clock.h
+#define SCHED_COUNTS_MS   CLOCK_COUNTS_MS
+// CPU cycles per Timer3 count and counts per ms
+#define SCHED_CYCLES_COUNT CLOCK_T3_PRESCALE
+#define SCHED_CYCLE_COUNTS_MS CLOCK_CYCLE_COUNTS_MS
+#define SCHED_CYCLES_MS   (F_CPU / 1000)
+// Longest single Timer1 interval in tickless mode, whole ms that fit in
+// OCR1A with a partial ms of tasksFrac still added on top
+#define SCHED_MAX_COUNTS  ((0xFFFFUL / SCHED_COUNTS_MS - 1) * SCHED_COUNTS_MS)
+#define SCHED_NO_TASK     0xFF
+// Most tasks the compile time folds below handle
+#define SCHED_MAX_TASKS   8
+// Ticks of release pattern looked at when placing phases
+#define SCHED_LOAD_SPAN   240
+
+#ifndef SCHED_PHASE_SLOTS
+#define SCHED_PHASE_SLOTS 1
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Compile time table arithmetic. Everything here is an enum constant so
+// it can size types and feed _Static_assert.
+
+// Euclid's algorithm unrolled into one enum constant per remainder so
+// the expansion grows linearly; n is the last non-zero remainder.
+// 24 steps cover any pair of 15 bit values.
+#define SCHED_GCD2(n, a, b) enum { \
+	n##_0 = (a), n##_1 = (b), \
+	n##_2 = n##_1 ? n##_0 % n##_1 : 0, \
+	n##_3 = n##_2 ? n##_1 % n##_2 : 0, \
+	n##_4 = n##_3 ? n##_2 % n##_3 : 0, \
+	n##_5 = n##_4 ? n##_3 % n##_4 : 0, \
+	n##_6 = n##_5 ? n##_4 % n##_5 : 0, \
+	n##_7 = n##_6 ? n##_5 % n##_6 : 0, \
+	n##_8 = n##_7 ? n##_6 % n##_7 : 0, \
+	n##_9 = n##_8 ? n##_7 % n##_8 : 0, \
+	n##_10 = n##_9 ? n##_8 % n##_9 : 0, \
+	n##_11 = n##_10 ? n##_9 % n##_10 : 0, \
+	n##_12 = n##_11 ? n##_10 % n##_11 : 0, \
+	n##_13 = n##_12 ? n##_11 % n##_12 : 0, \
+	n##_14 = n##_13 ? n##_12 % n##_13 : 0, \
+	n##_15 = n##_14 ? n##_13 % n##_14 : 0, \
+	n##_16 = n##_15 ? n##_14 % n##_15 : 0, \
+	n##_17 = n##_16 ? n##_15 % n##_16 : 0, \
+	n##_18 = n##_17 ? n##_16 % n##_17 : 0, \
+	n##_19 = n##_18 ? n##_17 % n##_18 : 0, \
+	n##_20 = n##_19 ? n##_18 % n##_19 : 0, \
+	n##_21 = n##_20 ? n##_19 % n##_20 : 0, \
+	n##_22 = n##_21 ? n##_20 % n##_21 : 0, \
+	n##_23 = n##_22 ? n##_21 % n##_22 : 0, \
+	n##_24 = n##_23 ? n##_22 % n##_23 : 0, \
+	n = (n##_1 ? 0 : n##_0) + (n##_2 ? 0 : n##_1) + (n##_3 ? 0 : n##_2) + \
+		(n##_4 ? 0 : n##_3) + (n##_5 ? 0 : n##_4) + (n##_6 ? 0 : n##_5) + \
+		(n##_7 ? 0 : n##_6) + (n##_8 ? 0 : n##_7) + (n##_9 ? 0 : n##_8) + \
+		(n##_10 ? 0 : n##_9) + (n##_11 ? 0 : n##_10) + (n##_12 ? 0 : n##_11) + \
+		(n##_13 ? 0 : n##_12) + (n##_14 ? 0 : n##_13) + (n##_15 ? 0 : n##_14) + \
+		(n##_16 ? 0 : n##_15) + (n##_17 ? 0 : n##_16) + (n##_18 ? 0 : n##_17) + \
+		(n##_19 ? 0 : n##_18) + (n##_20 ? 0 : n##_19) + (n##_21 ? 0 : n##_20) + \
+		(n##_22 ? 0 : n##_21) + (n##_23 ? 0 : n##_22) + (n##_24 ? 0 : n##_23) }
+
+// Applies m to the first SCHED_MAX_TASKS periods or phases, padding
+// with 0 which leaves both the GCD and the maximum unchanged
+#define SCHED_PERIOD_ARG(fn, st, ms, ph) ms,
+#define SCHED_PHASE_ARG(fn, st, ms, ph) ph,
+#define SCHED_FOLD(m, n, ...) SCHED_FOLD_(m, n, __VA_ARGS__)
+#define SCHED_FOLD_(m, n, a, b, c, d, e, f, g, h, ...) m(n, a, b, c, d, e, f, g, h)
+#define SCHED_GCD_ALL(n, a, b, c, d, e, f, g, h) \
+	SCHED_GCD2(n##1, a, b); SCHED_GCD2(n##2, n##1, c); \
+	SCHED_GCD2(n##3, n##2, d); SCHED_GCD2(n##4, n##3, e); \
+	SCHED_GCD2(n##5, n##4, f); SCHED_GCD2(n##6, n##5, g); \
+	SCHED_GCD2(n##7, n##6, h)
+#define SCHED_MAX2(a, b) ((a) > (b) ? (a) : (b))
+#define SCHED_MAX_ALL(n, a, b, c, d, e, f, g, h) \
+	SCHED_MAX2(SCHED_MAX2(SCHED_MAX2(a, b), SCHED_MAX2(c, d)), \
+	           SCHED_MAX2(SCHED_MAX2(e, f), SCHED_MAX2(g, h)))
+#define SCHED_ONE(fn, st, ms, ph) + 1
+#define SCHED_PROTO(fn, st, ms, ph) int fn(int);
+#define SCHED_CHECK(fn, st, ms, ph) \
+	_Static_assert((ms) > 0 && (ms) <= 0x7FFF, #fn " period must be 1 to 32767 ms"); \
+	_Static_assert((ph) >= 0 && (ph) < (ms), #fn " phase must be less than the period"); \
+	_Static_assert((ms) % TASKS_GCD == 0, #fn " period is not a multiple of the tick");
+
+TASK_TABLE(SCHED_PROTO)
+SCHED_FOLD(SCHED_GCD_ALL, SCHED_GP, TASK_TABLE(SCHED_PERIOD_ARG) 0, 0, 0, 0, 0, 0, 0, 0);
+SCHED_FOLD(SCHED_GCD_ALL, SCHED_GH, TASK_TABLE(SCHED_PHASE_ARG) 0, 0, 0, 0, 0, 0, 0, 0);
+SCHED_GCD2(SCHED_G, SCHED_GP7, SCHED_GH7);
+enum {
+	TASKS_COUNT = 0 TASK_TABLE(SCHED_ONE),
+	TASKS_GCD = SCHED_G / SCHED_PHASE_SLOTS,	// Tick in ms
+	TASKS_MAX_TICKS = SCHED_FOLD(SCHED_MAX_ALL, 0,
+		TASK_TABLE(SCHED_PERIOD_ARG) 0, 0, 0, 0, 0, 0, 0, 0) / TASKS_GCD
+};
+_Static_assert(TASKS_COUNT > 0 && TASKS_COUNT <= SCHED_MAX_TASKS, "1 to 8 tasks supported");
+_Static_assert(TASKS_GCD * SCHED_PHASE_SLOTS == SCHED_G, "periods can't be split into SCHED_PHASE_SLOTS");
+TASK_TABLE(SCHED_CHECK)
+
+// Smallest unsigned type that holds a period in ticks. Elapsed counts
+// can run up to a period plus one stride past it, so periods are kept
+// to half the type's range.
+typedef __typeof__(__builtin_choose_expr(TASKS_MAX_TICKS <= 0x7F,
+	(unsigned char)0, (unsigned int)0)) tasks_count_t;
+#define TASKS_PERIOD_LIMIT ((tasks_count_t)~(tasks_count_t)0 >> 1)
+
+// Index of each task in the table, TASK_<tick function>
+#define SCHED_INDEX(fn, st, ms, ph) TASK_##fn,
+enum { TASK_TABLE(SCHED_INDEX) };
 
 // Internal variables for mapping AVR's ISR to our cleaner TimerISR model.
-unsigned long tasksPeriodGCD = 1; // Start count from here, down to 0. Default 1ms
-unsigned long tasksPeriodCntDown = 0; // Current internal count of 1ms ticks
+unsigned int tasksPeriodCntDown = 0; // Current internal count of 1ms ticks
+tasks_count_t tasksStride = 1; // Ticks per TimerISR() pass, see TaskSetPeriod()
+unsigned char tasksCurrent = SCHED_NO_TASK; // Task being dispatched
+
+volatile unsigned int tasksCycleHi = 0; // Timer3 overflows, upper half of TasksCycles()
 
-unsigned char tasksNum = 0; // Number of tasks in the scheduler. Default 0 tasks
+volatile unsigned long tasksNow = 0;	// ms at the last compare match, see ClockMs()
+unsigned int tasksFrac = 0;		// Timer1 counts past tasksNow, tickless only
+#ifdef SCHED_TICKLESS
+unsigned char tasksHead = SCHED_NO_TASK; // Task with the nearest deadline
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Fixed part of a task, kept in flash
+typedef struct task_const {
+	int (*TickFct)(int); 		//Task tick function
+	tasks_count_t period; 		//Task period in ticks
+	tasks_count_t phase; 		//First release in ticks, 0 to place automatically
+	int state; 			//Initial state
+} task_const;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Struct for Tasks represent a running process in our simple real-time operating system
 typedef struct task {
-	signed 	 char state; 		//Task's current state
-	unsigned long period; 		//Task period
-	unsigned long elapsedTime; 	//Time elapsed since last task tick
-	int (*TickFct)(int); 		//Task tick function
+	int state; 			//Task's current state, or resume point of a coroutine
+	tasks_count_t period; 		//Task period in ticks
+	tasks_count_t elapsedTime; 	//Ticks elapsed since last task tick
+	volatile unsigned char ready;	//Released by TimerISR, waiting to run
+	unsigned long maxLate;		//Longest wait from release to dispatch
+	unsigned long execMin;		//Shortest tick in Timer3 counts
+	unsigned long execMax;		//Longest tick in Timer3 counts
+	unsigned long execSum;		//Total of the last runs ticks
+	unsigned int runs;		//Ticks in execSum
+	unsigned int overruns;		//Ticks that took longer than the period
+	unsigned int misses;		//Releases lost while the task was busy
+	unsigned long wake;		//ClockMs() a TASK_SLEEP() ends at
+#ifdef SCHED_TICKLESS
+	unsigned long deadline;		//ms of the next release
+	unsigned char next;		//Next task in deadline order
+#endif
 } task;
 
-task* tasks;
+task tasks[TASKS_COUNT];
+extern const task_const tasksConst[TASKS_COUNT] PROGMEM;
+
+#define SCHED_CONST_ENTRY(fn, st, ms, ph) { fn, (ms) / TASKS_GCD, (ph) / TASKS_GCD, st },
+// Instantiates the flash task table, after the tick functions and their
+// state enums are declared
+#define TASKS_DEFINE() \
+	const task_const tasksConst[TASKS_COUNT] PROGMEM = { TASK_TABLE(SCHED_CONST_ENTRY) }
+
+// Reads a tick count from the flash table
+#define SCHED_PGM_COUNT(p) ((tasks_count_t)(sizeof(tasks_count_t) == 1 ? \
+	pgm_read_byte(p) : pgm_read_word(p)))
+// Current period of task i, in ticks and in ms
+#define TaskPeriod(i) (tasks[i].period)
+#define TaskPeriodMs(i) ((unsigned long)TaskPeriod(i) * TASKS_GCD)
+#define TaskPhase(i) SCHED_PGM_COUNT(&tasksConst[i].phase)
+
+// Watchdog supervision of the tasks, on when WATCHDOG_TIMEOUT is defined
+#include "watchdog.h"
+
+// Longest period TaskSetPeriod() takes, in ms
+#define TASKS_PERIOD_MAX_MS \
+	((unsigned long)TASKS_PERIOD_LIMIT * TASKS_GCD < WATCHDOG_PERIOD_MAX ? \
+	 (unsigned long)TASKS_PERIOD_LIMIT * TASKS_GCD : WATCHDOG_PERIOD_MAX)
+
+// Most tasks released in a single tick with the table phases and with
+// the phases TimerOn() settled on
+unsigned char tasksPeakBefore = 0;
+unsigned char tasksPeakAfter = 0;
+
+#ifdef SIM_H
+#include <stdio.h>
+#include <stdlib.h>
+
+static void tasks_print(void) {
+	fprintf(stderr, "sched: peak tick %u tasks, %u with the table phases\n",
+		tasksPeakAfter, tasksPeakBefore);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Execution statistics for one task, as returned by TaskStats()
+typedef struct task_stats {
+	unsigned long min;		//Execution time in CPU cycles
+	unsigned long avg;
+	unsigned long max;
+	unsigned long maxLate;		//ms from release to dispatch
+	unsigned int overruns;
+	unsigned int misses;
+} task_stats;
+
+////////////////////////////////////////////////////////////////////////////////
+// Coroutine tasks. A tick function written as
+//     int tick_temp(int state) {
+//         TASK_BEGIN(state);
+//         therm_convert(1);
+//         TASK_WAIT_UNTIL(therm_converted(1));
+//         ...
+//         TASK_END();
+//     }
+// keeps its resume point in the task state and returns to the
+// dispatcher at every TASK_YIELD(), TASK_WAIT_UNTIL() or TASK_SLEEP(),
+// carrying on from there at its next release. Waits are checked once
+// per release, so they resolve to the task's period. Its table entry
+// starts in TASK_START. Locals don't survive a yield, keep anything
+// needed across one static, and don't yield from inside a nested switch
+// or put two yields on one line.
+#define TASK_START 0
+#define TASK_BEGIN(state) switch (state) { default: case TASK_START:
+// Back at the same point on the next release
+#define TASK_YIELD() do { return __LINE__; case __LINE__:; } while (0)
+// Checked now and at every release until c holds
+#define TASK_WAIT_UNTIL(c) case __LINE__: if (!(c)) return __LINE__
+// At least ms by ClockMs(), rounded up to the next release after that
+#define TASK_SLEEP(ms) do { \
+	tasks[tasksCurrent].wake = ClockMs() + (ms); \
+	case __LINE__: if ((long)(ClockMs() - tasks[tasksCurrent].wake) < 0) return __LINE__; \
+	} while (0)
+// Restarts from TASK_BEGIN() on the next release
+#define TASK_END() } return TASK_START
+
+///////////////////////////////////////////////////////////////////////////////
+// Timer3 runs free as the cycle counter; its overflow extends it to 32 bits
+ISR(TIMER3_OVF_vect) {
+	tasksCycleHi++;
+	TRACE_WRAP(tasksCycleHi);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns the free-running counter, in units of SCHED_CYCLES_COUNT cycles
+unsigned long TasksCycles() {
+	unsigned long hi;
+	unsigned int lo;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		lo = TCNT3;
+		hi = tasksCycleHi;
+		// Overflow happened but its interrupt has not run yet
+		if ((TIFR3 & (1 << TOV3)) && lo < 0x8000) {
+			hi++;
+		}
+	}
+	return (hi << 16) | lo;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fills stats for task i
+void TaskStats(unsigned char i, task_stats *stats) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		stats->min = tasks[i].runs ? tasks[i].execMin * SCHED_CYCLES_COUNT : 0;
+		stats->avg = tasks[i].runs ?
+			tasks[i].execSum / tasks[i].runs * SCHED_CYCLES_COUNT : 0;
+		stats->max = tasks[i].execMax * SCHED_CYCLES_COUNT;
+		stats->maxLate = tasks[i].maxLate;
+		stats->overruns = tasks[i].overruns;
+		stats->misses = tasks[i].misses;
+	}
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-// Heart of the scheduler code
+// Clears the statistics of every task
+void TasksStatsClear() {
+	unsigned char i;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (i = 0; i < TASKS_COUNT; i++) {
+			tasks[i].maxLate = 0;
+			tasks[i].execMin = 0xFFFFFFFF;
+			tasks[i].execMax = 0;
+			tasks[i].execSum = 0;
+			tasks[i].runs = 0;
+			tasks[i].overruns = 0;
+			tasks[i].misses = 0;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Accounts one finished tick of task i that took exec Timer3 counts
+void TasksRecord(unsigned char i, unsigned long exec) {
+	if (exec < tasks[i].execMin) {
+		tasks[i].execMin = exec;
+	}
+	if (exec > tasks[i].execMax) {
+		tasks[i].execMax = exec;
+	}
+	// Halve the running total instead of letting it overflow
+	if (tasks[i].runs == 0xFFFF || tasks[i].execSum + exec < tasks[i].execSum) {
+		tasks[i].execSum >>= 1;
+		tasks[i].runs >>= 1;
+	}
+	tasks[i].execSum += exec;
+	tasks[i].runs++;
+	if (exec > TaskPeriodMs(i) * SCHED_CYCLE_COUNTS_MS) {
+		tasks[i].overruns++;
+	}
+}
+
+#ifndef SCHED_TICKLESS
+
+///////////////////////////////////////////////////////////////////////////////
+// Heart of the scheduler code. Runs in interrupt context, so it only
+// releases tasks; TasksDispatch() runs them from the main loop.
 void TimerISR() {
     static unsigned char i;
-    for (i = 0; i < tasksNum; i++) { 
-        if ( tasks[i].elapsedTime >= tasks[i].period ) { // Ready
-            tasks[i].state = tasks[i].TickFct(tasks[i].state);
+    unsigned char released = 0;
+    for (i = 0; i < TASKS_COUNT; i++) {
+        if ( tasks[i].elapsedTime >= TaskPeriod(i) ) { // Ready
+            if (tasks[i].ready) {
+                tasks[i].misses++;
+            }
+            tasks[i].ready = 1;
             tasks[i].elapsedTime = 0;
+            released++;
         }
-        tasks[i].elapsedTime += tasksPeriodGCD;
+        tasks[i].elapsedTime += tasksStride;
     }
+    if (released) {
+        TRACE(TICK, released);
+    }
+    WatchdogSupervise();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // In our approach, the C programmer does not touch this ISR, but rather TimerISR()
 ISR(TIMER1_COMPA_vect) {
-	// CPU automatically calls when TCNT0 == OCR0 (every 1 ms per TimerOn settings)
-	tasksPeriodCntDown--; 			// Count down to 0 rather than up to TOP
-	if (tasksPeriodCntDown == 0) { 	// results in a more efficient compare
+	BENCH_BEGIN(TIMER_ISR);
+	// CPU automatically calls when TCNT1 == OCR1A (every 1 ms per ClockOn settings)
+	tasksNow++;
+	// Count down to 0 rather than up to TOP, results in a more efficient
+	// compare. Stays 0 until TimerOn() starts the tasks.
+	if (tasksPeriodCntDown && --tasksPeriodCntDown == 0) {
+		BENCH_BEGIN(TICK);
 		TimerISR(); 				// Call the ISR that the user uses
-		tasksPeriodCntDown = tasksPeriodGCD;
+		BENCH_END(TICK);
+		tasksPeriodCntDown = TASKS_GCD * tasksStride;
 	}
+	BENCH_END(TIMER_ISR);
+}
+
+#else // SCHED_TICKLESS
+
+///////////////////////////////////////////////////////////////////////////////
+// Links task i into the deadline ordered list. Interrupts must be off.
+void TasksInsert(unsigned char i) {
+    unsigned char *link = &tasksHead;
+    while (*link != SCHED_NO_TASK &&
+            (long)(tasks[*link].deadline - tasks[i].deadline) <= 0) {
+        link = &tasks[*link].next;
+    }
+    tasks[i].next = *link;
+    *link = i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Programs OCR1A for the head of the list, with Timer1 at now. tasksFrac
+// counts already run since tasksNow are subtracted so time stays exact
+// across reprogramming. Interrupts must be off.
+void TasksArmAt(unsigned int now) {
+    unsigned long counts = SCHED_MAX_COUNTS;
+    if (tasksHead != SCHED_NO_TASK) {
+        long ms = tasks[tasksHead].deadline - tasksNow;
+        if (ms <= 0) {
+            counts = 1;
+        }
+        else if (ms < (long)(SCHED_MAX_COUNTS / SCHED_COUNTS_MS)) {
+            counts = ms * SCHED_COUNTS_MS - tasksFrac;
+        }
+    }
+    // Don't program a compare value the counter has already passed,
+    // it would only match after wrapping through 0xFFFF
+    if (counts <= now + 2) {
+        counts = now + 2;
+    }
+    OCR1A = counts - 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Set TimerISR() to tick every m ms
-void TimerSet(unsigned long m) {
-	tasksPeriodGCD = m;
-	tasksPeriodCntDown = tasksPeriodGCD;
+// TasksArmAt() from task context. Interrupts must be off. While a match
+// is pending the ISR still has to read the interval that ended from
+// OCR1A, and it re-arms right after anyway.
+void TasksArm() {
+    if (!(TIFR1 & (1 << OCF1A))) {
+        TasksArmAt(TCNT1);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-void TimerOn() {
+// Advances time by the interval that just finished and releases every
+// task that is due. Cost depends on the number of due tasks only.
+ISR(TIMER1_COMPA_vect) {
+	BENCH_BEGIN(TIMER_ISR);
+	tasksFrac += OCR1A + 1;
+	tasksNow += tasksFrac / SCHED_COUNTS_MS;
+	tasksFrac %= SCHED_COUNTS_MS;
+	unsigned char released = 0;
+	BENCH_BEGIN(TICK);
+	while (tasksHead != SCHED_NO_TASK &&
+			(long)(tasks[tasksHead].deadline - tasksNow) <= 0) {
+		tasks[tasksHead].ready = 1;
+		tasksHead = tasks[tasksHead].next;
+		released++;
+	}
+	BENCH_END(TICK);
+	if (released) {
+		TRACE(TICK, released);
+	}
+	WatchdogSupervise();
+	// The flag sets as the counter clears, so it has restarted by now
+	TasksArmAt(TCNT1);
+	BENCH_END(TIMER_ISR);
+}
+
+#endif // SCHED_TICKLESS
+
+///////////////////////////////////////////////////////////////////////////////
+// Timer1 counts since tasksNow, including an interval that has ended
+// but whose interrupt hasn't run yet. Interrupts must be off.
+unsigned long ClockCounts() {
+	unsigned long counts = tasksFrac;
+	unsigned int now = TCNT1;
+	if (TIFR1 & (1 << OCF1A)) {
+		// Read again so the count is surely past the wrap
+		now = TCNT1;
+		counts += OCR1A + 1;
+	}
+	return counts + now;
+}
+
+unsigned long ClockMs() {
+	unsigned long ms;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = tasksNow + ClockCounts() / SCHED_COUNTS_MS;
+	}
+	return ms;
+}
+
+unsigned long ClockUs() {
+	unsigned long us;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		us = tasksNow * 1000 + ClockCounts() * 1000 / SCHED_COUNTS_MS;
+	}
+	return us;
+}
+
+unsigned char ClockExpired(unsigned long start, unsigned long ms) {
+	return ClockMs() - start >= ms;
+}
+
+unsigned char ClockExpiredUs(unsigned long start, unsigned long us) {
+	return ClockUs() - start >= us;
+}
+
+// Timed in us so a delay started just before a ms boundary isn't cut short
+void ClockDelayMs(unsigned int ms) {
+	unsigned long start = ClockUs();
+	while (!ClockExpiredUs(start, (unsigned long)ms * 1000));
+}
+
+void ClockDelayUs(unsigned int us) {
+	unsigned long start = ClockUs();
+	while (!ClockExpiredUs(start, us));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Puts the CPU in idle sleep until the next interrupt unless a task is
+// already waiting. Timer1 is clocked from the I/O clock so idle is the
+// deepest mode that still wakes on it; power-save would need Timer2
+// with an external 32 kHz crystal.
+void TasksIdle() {
+    unsigned char i;
+    cli();
+    for (i = 0; i < TASKS_COUNT; i++) {
+        if (tasks[i].ready) {
+            sei();
+            return;
+        }
+    }
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    sei();          // The instruction after sei always runs, so no
+    sleep_cpu();    // wakeup can slip in between the check and sleep
+    sleep_disable();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs every released task once, with interrupts enabled. Call this
+// repeatedly from main(). Since elapsedTime restarts on release, its
+// value at dispatch less the time left to the pass it is counted up to
+// is how late the task runs, kept in maxLate.
+void TasksDispatch() {
+    unsigned char i;
+    unsigned long late;
+    unsigned long start;
+    for (i = 0; i < TASKS_COUNT; i++) {
+        if (!tasks[i].ready) {
+            continue;
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            tasks[i].ready = 0;
+#ifndef SCHED_TICKLESS
+            late = (unsigned long)tasks[i].elapsedTime * TASKS_GCD - tasksPeriodCntDown;
+#else
+            late = tasksNow - tasks[i].deadline;
+#endif
+        }
+        if (late > tasks[i].maxLate) {
+            tasks[i].maxLate = late;
+        }
+        tasksCurrent = i;
+        WatchdogRun(i);
+        start = TasksCycles();
+        TRACE(TASK, i);
+        BENCH_BEGIN(TASK);
+        tasks[i].state = ((int (*)(int))pgm_read_ptr(&tasksConst[i].TickFct))(tasks[i].state);
+        BENCH_END(TASK);
+        TasksRecord(i, TasksCycles() - start);
+        WatchdogCheckIn(i);
+        tasksCurrent = SCHED_NO_TASK;
+#ifdef SCHED_TICKLESS
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            // Skip releases missed while the task was running
+            tasks[i].deadline += TaskPeriodMs(i);
+            while ((long)(tasks[i].deadline - tasksNow) <= 0) {
+                tasks[i].deadline += TaskPeriodMs(i);
+                tasks[i].misses++;
+            }
+            TasksInsert(i);
+            if (tasksHead == i) {
+                TasksArm();
+            }
+        }
+#endif
+    }
+    TasksIdle();
+}
+
+#ifndef SCHED_TICKLESS
+///////////////////////////////////////////////////////////////////////////////
+// Brings the next TimerISR() pass in to the next tick, taking the ticks
+// it skips off the elapsed counts, which already include them. A period
+// changed now then doesn't wait out a long stride under way. Interrupts
+// must be off.
+void TasksRewind() {
+    unsigned char i;
+    tasks_count_t early = (tasksPeriodCntDown - 1) / TASKS_GCD;
+    for (i = 0; i < TASKS_COUNT; i++) {
+        tasks[i].elapsedTime -= early;
+    }
+    tasksPeriodCntDown -= early * TASKS_GCD;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Picks the longest TimerISR() passes that still land exactly on every
+// task's next release. After TasksRewind() the next pass is the next
+// tick; it moves out to the nearest release, and the stride from there
+// is the GCD of all periods and of the ticks left until each next
+// release. Interrupts must be off.
+void TasksResync() {
+    unsigned char i;
+    tasks_count_t g = 0, a, b, t;
+    tasks_count_t skip = TASKS_PERIOD_LIMIT;
+    for (i = 0; i < TASKS_COUNT; i++) {
+        b = tasks[i].elapsedTime < tasks[i].period ?
+            tasks[i].period - tasks[i].elapsedTime : 0;
+        skip = b < skip ? b : skip;
+    }
+    for (i = 0; i < TASKS_COUNT; i++) {
+        tasks[i].elapsedTime += skip;
+        a = tasks[i].period;
+        b = tasks[i].elapsedTime < a ? a - tasks[i].elapsedTime : 0;
+        while (b) {
+            t = a % b;
+            a = b;
+            b = t;
+        }
+        b = g;
+        while (b) {
+            t = a % b;
+            a = b;
+            b = t;
+        }
+        g = a;
+    }
+    tasksPeriodCntDown += skip * TASKS_GCD;
+    // The next pass checks the counts as they are now, then adds the
+    // new stride
+    tasksStride = g;
+}
+#else
+///////////////////////////////////////////////////////////////////////////////
+// Unlinks task i from the deadline ordered list. Interrupts must be off.
+void TasksRemove(unsigned char i) {
+    unsigned char *link = &tasksHead;
+    while (*link != SCHED_NO_TASK) {
+        if (*link == i) {
+            *link = tasks[i].next;
+            return;
+        }
+        link = &tasks[*link].next;
+    }
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Changes the period of task i to ms, which must be a multiple of
+// TASKS_GCD and at most TASKS_PERIOD_MAX_MS. Tasks may change their own
+// period. A task waiting on a longer period is pulled in so the new one
+// applies from now. Returns 0 if the period can't be represented.
+unsigned char TaskSetPeriod(unsigned char i, unsigned int ms) {
+    tasks_count_t ticks = ms / TASKS_GCD;
+    if (ms % TASKS_GCD || ticks == 0 || ms > TASKS_PERIOD_MAX_MS) {
+        return 0;
+    }
+    if (ticks == tasks[i].period) {
+        return 1;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        tasks[i].period = ticks;
+#ifndef SCHED_TICKLESS
+        // Not before TimerOn(), which loads the table periods anyway
+        if (tasksPeriodCntDown) {
+            TasksRewind();
+            if (tasks[i].elapsedTime > ticks && !tasks[i].ready) {
+                tasks[i].elapsedTime = ticks;
+            }
+            TasksResync();
+        }
+#else
+        // Only tasks in the list have a pending deadline to move
+        if (!tasks[i].ready && i != tasksCurrent &&
+                (long)(tasks[i].deadline - tasksNow) > (long)ms) {
+            TasksRemove(i);
+            tasks[i].deadline = tasksNow + ms;
+            TasksInsert(i);
+            TasksArm();
+        }
+#endif
+    }
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Length of the repeating release pattern in ticks, the LCM of all
+// periods, capped to SCHED_LOAD_SPAN
+unsigned int TasksSpan() {
+    unsigned long span = 1;
+    unsigned int a, b, t;
+    unsigned char i;
+    for (i = 0; i < TASKS_COUNT; i++) {
+        a = span;
+        b = TaskPeriod(i);
+        while (b) {
+            t = a % b;
+            a = b;
+            b = t;
+        }
+        span = span / a * TaskPeriod(i);
+        if (span >= SCHED_LOAD_SPAN) {
+            return SCHED_LOAD_SPAN;
+        }
+    }
+    return span;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Adds the releases of task i at the given phase to load, a count of
+// releases per tick over span ticks. Returns the busiest of those ticks
+// before adding, or just reports it when add is 0.
+unsigned char TasksLoad(unsigned char *load, unsigned int span,
+        unsigned char i, tasks_count_t phase, unsigned char add) {
+    unsigned int t;
+    unsigned char peak = 0;
+    for (t = phase; t < span; t += TaskPeriod(i)) {
+        if (load[t] > peak) {
+            peak = load[t];
+        }
+        load[t] += add;
+    }
+    return peak;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Busiest tick for the given phases
+unsigned char TasksPeak(const tasks_count_t *phase) {
+    unsigned char load[SCHED_LOAD_SPAN];
+    unsigned int span = TasksSpan();
+    unsigned char i;
+    unsigned char peak = 0;
+    memset(load, 0, span);
+    for (i = 0; i < TASKS_COUNT; i++) {
+        TasksLoad(load, span, i, phase[i], 1);
+    }
+    for (i = 0; i < TASKS_COUNT; i++) {
+        unsigned char p = TasksLoad(load, span, i, phase[i], 0);
+        peak = p > peak ? p : peak;
+    }
+    return peak;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Picks each task's first release. Tasks with a table phase keep it;
+// with SCHED_PHASE_SLOTS > 1 the rest are placed one at a time at the
+// offset whose busiest tick is least loaded so far.
+void TasksPhases(tasks_count_t *phase) {
+    unsigned char i;
+    for (i = 0; i < TASKS_COUNT; i++) {
+        phase[i] = TaskPhase(i);
+    }
+    tasksPeakBefore = TasksPeak(phase);
+#if SCHED_PHASE_SLOTS > 1
+    {
+        unsigned char load[SCHED_LOAD_SPAN];
+        unsigned int span = TasksSpan();
+        tasks_count_t o;
+        unsigned char peak, best;
+        memset(load, 0, span);
+        for (i = 0; i < TASKS_COUNT; i++) {
+            if (phase[i]) {
+                TasksLoad(load, span, i, phase[i], 1);
+            }
+        }
+        for (i = 0; i < TASKS_COUNT; i++) {
+            if (TaskPhase(i)) {
+                continue;
+            }
+            best = 0xFF;
+            for (o = 0; o < TaskPeriod(i) && o < span; o++) {
+                peak = TasksLoad(load, span, i, o, 0);
+                if (peak < best) {
+                    best = peak;
+                    phase[i] = o;
+                }
+            }
+            TasksLoad(load, span, i, phase[i], 1);
+        }
+    }
+#endif
+    tasksPeakAfter = TasksPeak(phase);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Starts the clock. Safe to call early in main() so drivers have time
+// and timeouts before the tasks start.
+void ClockOn() {
+	cli();
+	tasksNow = 0;
+	tasksFrac = 0;
+
+	// Timer3 free-running at /8 for execution time measurements
+	TCCR3A 	= 0;
+	TCCR3B 	= CLOCK_T3_CS;
+	TCNT3 	= 0;
+	TIMSK3 	= (1<<TOIE3);
+
 	// AVR timer/counter controller register TCCR1
-	TCCR1B 	= (1<<WGM12)|(1<<CS11)|(1<<CS10);
+	TCCR1B 	= (1<<WGM12)|CLOCK_T1_CS;
                     // WGM12 (bit3) = 1: CTC mode (clear timer on compare)
-					// CS12,CS11,CS10 (bit2bit1bit0) = 011: prescaler /64
-					// Thus TCCR1B = 00001011 or 0x0B
+					// CS12,CS11,CS10 (bit2bit1bit0) = CLOCK_T1_PRESCALE
+					// e.g. 011: prescaler /64, TCCR1B = 00001011 or 0x0B
 					// So, 8 MHz clock or 8,000,000 /64 = 125,000 ticks/s
 					// Thus, TCNT1 register will count at 125,000 ticks/s
 
+	// Initialize avr counter
+	TCNT1 = 0;
+	TIFR1 	= (1<<OCF1A);
+
 	// AVR output compare register OCR1A.
-	OCR1A 	= 125;	// Timer interrupt will be generated when TCNT1==OCR1A
+#ifndef SCHED_TICKLESS
+	OCR1A 	= SCHED_COUNTS_MS - 1;	// Timer interrupt will be generated when TCNT1==OCR1A
 					// We want a 1 ms tick. 0.001 s * 125,000 ticks/s = 125
-					// So when TCNT1 register equals 125,
-					// 1 ms has passed. Thus, we compare to 125.
-					// AVR timer interrupt mask register
+					// The counter clears on the count after the match,
+					// so 0 to 124 is 125 counts and 1 ms has passed.
+#else
+	TasksArm();	// Nothing queued yet, just keeps time
+#endif
 
 #if defined (__AVR_ATmega1284__)
     TIMSK1 	= (1<<OCIE1A); // OCIE1A (bit1): enables compare match interrupt - ATMega1284
@@ -82,14 +831,54 @@ void TimerOn() {
     TIMSK 	= (1<<OCIE1A); // OCIE1A (bit1): enables compare match interrupt - ATMega32
 #endif
 
-	// Initialize avr counter
-	TCNT1 = 0;
-
-	// TimerISR will be called every tasksPeriodCntDown milliseconds
-	tasksPeriodCntDown = tasksPeriodGCD;
-
 	// Enable global interrupts
 	SREG |= 0x80;	// 0x80: 1000000
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Loads the task table and starts ticking every TASKS_GCD ms. Each task
+// is released on the tick after its phase.
+void TimerOn() {
+	unsigned char i;
+	tasks_count_t phase[TASKS_COUNT];
+#if defined (__AVR_ATmega1284__)
+	if (!(TIMSK1 & (1<<OCIE1A))) {
+#else
+	if (!(TIMSK & (1<<OCIE1A))) {
+#endif
+		ClockOn();
+	}
+	for (i = 0; i < TASKS_COUNT; i++) {
+		tasks[i].period = SCHED_PGM_COUNT(&tasksConst[i].period);
+	}
+	TasksPhases(phase);
+#ifdef SIM_H
+	atexit(tasks_print);
+#endif
+	tasksStride = 1;
+	for (i = 0; i < TASKS_COUNT; i++) {
+		tasks[i].state = pgm_read_word(&tasksConst[i].state);
+		tasks[i].elapsedTime = TaskPeriod(i) - phase[i];
+		tasks[i].ready = 0;
+	}
+	TasksStatsClear();
+	WatchdogOn();
+
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+#ifndef SCHED_TICKLESS
+		// TimerISR will be called every tasksPeriodCntDown milliseconds,
+		// from the next 1 ms interrupt on
+		tasksPeriodCntDown = TASKS_GCD;
+#else
+		// Same first releases as in the ticked scheduler
+		tasksHead = SCHED_NO_TASK;
+		for (i = 0; i < TASKS_COUNT; i++) {
+			tasks[i].deadline = tasksNow + (unsigned long)(phase[i] + 1) * TASKS_GCD;
+			TasksInsert(i);
+		}
+		TasksArm();
+#endif
+	}
+}
+
 #endif //SCHEDULER_H
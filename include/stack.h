@@ -0,0 +1,96 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// Stack high-water mark. Everything from the end of the static
+// variables up to RAMEND is painted with STACK_CANARY before main()
+// runs, so the lowest byte ever written by the stack shows how deep it
+// went. Nothing here uses the heap, so the whole gap is stack.
+//
+// StackFree() scans the gap and takes about 5 cycles per free byte,
+// ms at a time on an idle 1284P, so it is for asking on demand. The
+// first STACK_GUARD bytes above the static variables are a tripwire
+// instead: StackOk() only looks at those and is cheap enough to call
+// every tick, failing while the stack still has the guard to spare
+// before it reaches the scheduler's tasks and the rest of .bss.
+//
+// Include from main.c only; the painting is linked in from here.
+
+#define STACK_CANARY 0xC5
+#define STACK_GUARD  32
+
+#ifndef SIM_H
+
+extern uint8_t __data_start;	// Linker symbols: start of .data,
+extern uint8_t _end;		// end of .bss and .noinit,
+extern uint8_t __stack;		// and the top of RAM
+
+// Runs in .init1, before the stack pointer and r1 are set up, so no C
+void StackPaint(void) __attribute__((naked, used, section(".init1")));
+void StackPaint(void) {
+	__asm__ __volatile__ (
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		"	breq 1b\n"
+		:: "M" (STACK_CANARY));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Bytes of static variables, .data, .bss and .noinit
+uint16_t StackStatic() {
+	return &_end - &__data_start;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Bytes of stack never used since reset, the headroom
+uint16_t StackFree() {
+	const uint8_t *p = &_end;
+	while (p <= &__stack && *p == STACK_CANARY) {
+		p++;
+	}
+	return p - &_end;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Deepest the stack has been since reset, in bytes
+uint16_t StackMax() {
+	return &__stack - &_end + 1 - StackFree();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Zero once the stack has reached the guard bytes
+uint8_t StackOk() {
+	const uint8_t *p;
+	for (p = &_end; p < &_end + STACK_GUARD; p++) {
+		if (*p != STACK_CANARY) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#else
+
+// The host build runs on the PC's own stack, there is nothing to measure
+#define StackStatic() 0
+#define StackFree() 0
+#define StackMax() 0
+#define StackOk() 1
+
+#endif
+
+#endif //STACK_H
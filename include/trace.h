@@ -0,0 +1,185 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Event trace: a ring of the last TRACE_SIZE events, each an id, a byte
+// of payload and the low 16 bits of the Timer3 cycle counter, for
+// seeing scheduling, radio and motor events in order from the field.
+// The Makefile turns it on by setting TRACE_SIZE, a power of two up to
+// 256, for every file of the firmware; TRACE_DEFINE() in main.c holds
+// the ring. Without TRACE_SIZE every TRACE() compiles to nothing.
+//
+// A record is four stores with interrupts held off, about 20 cycles.
+// Timer3 wraps every 2^16 counts (65 ms at 8 MHz). Wraps are recorded
+// too, with the low byte of the overflow count, so the decoder can
+// rebuild absolute time; a wrap that follows another replaces it rather
+// than filling the ring while nothing happens. Quiet spells longer
+// than 256 wraps, 16 s at 8 MHz, come out short by a multiple of that.
+//
+// TraceDumpBegin() freezes the ring and TraceDumpByte() then hands out
+// the dump one byte at a time, for whoever is sending it to pace. The
+// decoder in ../trace turns a dump into a timeline.
+
+// Event list: name and id, 1 to 255. The decoder reads its names from
+// here as well.
+#define TRACE_EVENTS(X) \
+	X(CYCLE_WRAP,  1)	/* Timer3 overflow, arg: overflows so far */ \
+	X(TICK,        2)	/* Timer1 release pass, arg: tasks released */ \
+	X(TASK,        3)	/* Task tick starts, arg: task number */ \
+	X(NRF_SEND,    4)	/* nrf24_send(), arg: first payload byte */ \
+	X(NRF_RECEIVE, 5)	/* nrf24_getData(), arg: first payload byte */ \
+	X(MOTOR_START, 6)	/* Stepper wakes, arg: direction */ \
+	X(MOTOR_STOP,  7)	/* Stepper sleeps, arg: percent open */ \
+	X(THERM_START, 8)	/* Temperature conversion starts, arg: bus */ \
+	X(THERM_DONE,  9)	/* Temperature read, arg: degrees F */
+
+#define TRACE_ENUM(name, id) TRACE_##name = id,
+enum trace_event { TRACE_EVENTS(TRACE_ENUM) };
+#undef TRACE_ENUM
+
+// Dump: TRACE_MAGIC, the version, Timer3 counts per second (4 bytes),
+// the record count (2 bytes), the records oldest first as id, arg and
+// time (2 bytes), then the low byte of the sum of every byte after the
+// magic. Multi-byte fields are little endian.
+#define TRACE_MAGIC      "TRC"
+#define TRACE_VERSION    1
+#define TRACE_HEADER     10
+#define TRACE_RECORD     4
+
+#if defined(TRACE_SIZE) && !defined(TRACE_HOST)
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "clock.h"
+
+_Static_assert(TRACE_SIZE >= 2 && TRACE_SIZE <= 256 && (TRACE_SIZE & (TRACE_SIZE - 1)) == 0,
+	"TRACE_SIZE must be a power of two from 2 to 256");
+
+typedef struct trace_record {
+	uint8_t id;
+	uint8_t arg;
+	uint16_t time;		// Timer3 counts
+} trace_record;
+
+extern trace_record trace_buf[TRACE_SIZE];
+extern uint8_t trace_head;		// Next slot, modulo TRACE_SIZE
+extern uint8_t trace_full;		// The ring has wrapped at least once
+extern volatile uint8_t trace_paused;	// Set while a dump reads the ring
+
+typedef struct trace_dump_state {
+	uint16_t index, count;		// Byte of the dump, records in it
+	uint8_t first, sum;
+} trace_dump_state;
+
+extern trace_dump_state trace_dump;
+
+#define TRACE_DEFINE() \
+	trace_record trace_buf[TRACE_SIZE]; \
+	uint8_t trace_head; \
+	uint8_t trace_full; \
+	volatile uint8_t trace_paused; \
+	trace_dump_state trace_dump
+
+static inline void trace_put(uint8_t id, uint8_t arg) {
+	uint8_t sreg = SREG;
+	trace_record *r;
+	cli();
+	if (!trace_paused) {
+		r = &trace_buf[trace_head & (TRACE_SIZE - 1)];
+		r->id = id;
+		r->arg = arg;
+		r->time = TCNT3;
+		if (!(++trace_head & (TRACE_SIZE - 1))) {
+			trace_full = 1;
+		}
+	}
+	SREG = sreg;
+}
+
+#define TRACE(event, arg) trace_put(TRACE_##event, (arg))
+
+// Records Timer3 overflow count, from its interrupt
+static inline void trace_wrap(uint8_t count) {
+	trace_record *r = &trace_buf[(uint8_t)(trace_head - 1) & (TRACE_SIZE - 1)];
+	if (!trace_paused && (trace_head & (TRACE_SIZE - 1) || trace_full) &&
+			r->id == TRACE_CYCLE_WRAP) {
+		r->arg = count;
+		r->time = TCNT3;
+	}
+	else {
+		trace_put(TRACE_CYCLE_WRAP, count);
+	}
+}
+
+#define TRACE_WRAP(count) trace_wrap(count)
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Freezes the ring and starts a dump of it
+static inline void TraceDumpBegin() {
+	trace_paused = 1;
+	trace_dump.count = trace_full ? TRACE_SIZE : trace_head & (TRACE_SIZE - 1);
+	trace_dump.first = trace_full ? trace_head : 0;
+	trace_dump.index = 0;
+	trace_dump.sum = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Next byte of the dump. Recording resumes after the last.
+//Returns: The byte, or -1 once the dump is over
+static inline int TraceDumpByte() {
+	static const char magic[] = TRACE_MAGIC;
+	const unsigned long rate = F_CPU / CLOCK_T3_PRESCALE;
+	uint16_t i = trace_dump.index;
+	uint16_t records = TRACE_RECORD * trace_dump.count;
+	const trace_record *r;
+	uint8_t b;
+	if (!trace_paused) {
+		return -1;
+	}
+	if (i < sizeof(magic) - 1) {
+		trace_dump.index++;
+		return magic[i];
+	}
+	if (i == TRACE_HEADER + records) {
+		trace_paused = 0;
+		return trace_dump.sum;
+	}
+	if (i < TRACE_HEADER) {
+		switch (i) {
+			case 3: b = TRACE_VERSION; break;
+			case 4: case 5: case 6: case 7: b = rate >> (8 * (i - 4)); break;
+			case 8: b = trace_dump.count; break;
+			default: b = trace_dump.count >> 8; break;
+		}
+	}
+	else {
+		i -= TRACE_HEADER;
+		r = &trace_buf[(uint8_t)(trace_dump.first + i / TRACE_RECORD) & (TRACE_SIZE - 1)];
+		switch (i % TRACE_RECORD) {
+			case 0: b = r->id; break;
+			case 1: b = r->arg; break;
+			case 2: b = r->time; break;
+			default: b = r->time >> 8; break;
+		}
+	}
+	trace_dump.index++;
+	trace_dump.sum += b;
+	return b;
+}
+
+#else
+
+#define TRACE(event, arg) ((void)0)
+#define TRACE_WRAP(count) ((void)0)
+#define TRACE_DEFINE() extern uint8_t trace_unused
+#define TraceDumpBegin() ((void)0)
+#define TraceDumpByte() (-1)
+
+#endif
+
+#endif //TRACE_H
@@ -0,0 +1,95 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef UART_H
+#define UART_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include "ring.h"
+
+// USART1 at UART_BAUD, 8N1, for a debug link to a PC. USART0 shares its
+// pins with the window's buttons, so this is the one left: TXD1 is PD3
+// and RXD1 is PD2. Keep both free of other uses on any board that runs
+// the UART.
+//
+// Both directions go through rings serviced by the USART interrupts,
+// so neither UartPut() nor UartGet() ever waits on the line. Check
+// UartFree() first when every byte has to get out. Bytes that come in
+// while the receive ring is full are dropped and counted.
+
+#ifndef UART_BAUD
+#define UART_BAUD 38400UL
+#endif
+
+// Double speed keeps the rate error at 0.2% at 8 MHz
+#define UART_UBRR ((F_CPU + 4 * UART_BAUD) / (8 * UART_BAUD) - 1)
+_Static_assert(UART_UBRR <= 0xFFF, "UART_BAUD is too slow for this F_CPU");
+
+// Ring sizes, powers of two up to 128
+#ifndef UART_TX_SIZE
+#define UART_TX_SIZE 128
+#endif
+#ifndef UART_RX_SIZE
+#define UART_RX_SIZE 64
+#endif
+
+RING_DECLARE(uart_tx, uint8_t, UART_TX_SIZE);
+RING_DECLARE(uart_rx, uint8_t, UART_RX_SIZE);
+uint16_t uart_rx_dropped;	// Received with the ring full, or framing errors
+
+ISR(USART1_RX_vect) {
+	uint8_t bad = UCSR1A & ((1 << FE1) | (1 << DOR1));
+	uint8_t c = UDR1;
+	if (bad || !RING_PUSH(uart_rx, c)) {
+		uart_rx_dropped++;
+	}
+}
+
+ISR(USART1_UDRE_vect) {
+	uint8_t c;
+	if (RING_POP(uart_tx, &c)) {
+		UDR1 = c;
+	}
+	else {
+		UCSR1B &= ~(1 << UDRIE1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Sets up USART1 for sending and receiving at UART_BAUD
+void UartInit() {
+	UBRR1 = UART_UBRR;
+	UCSR1A = 1 << U2X1;
+	UCSR1C = (1 << UCSZ11) | (1 << UCSZ10);
+	UCSR1B = (1 << RXCIE1) | (1 << RXEN1) | (1 << TXEN1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Bytes UartPut() can take without dropping any
+uint8_t UartFree() {
+	return RING_SIZE(uart_tx) - RING_COUNT(uart_tx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Queues c for sending
+//Returns: 0 if the queue was full and c is dropped
+uint8_t UartPut(uint8_t c) {
+	if (!RING_PUSH(uart_tx, c)) {
+		return 0;
+	}
+	UCSR1B |= 1 << UDRIE1;
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Takes a received byte, if there is one
+//Returns: 0 if nothing has come in
+uint8_t UartGet(uint8_t *c) {
+	return RING_POP(uart_rx, c);
+}
+
+#endif //UART_H
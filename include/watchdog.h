@@ -0,0 +1,190 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <stdint.h>
+#include <util/atomic.h>
+#include "clock.h"
+
+// Hardware watchdog supervision of the scheduler's tasks. Included by
+// scheduler.h; define WATCHDOG_TIMEOUT as one of avr/wdt.h's WDTO_
+// values before including that to turn it on.
+//
+// Each task checks in whenever a tick of it returns. The scheduler
+// interrupt feeds the watchdog only while every task has checked in
+// within twice its period and WATCHDOG_SLACK_MS, so a tick stuck in a
+// loop stops the feeding and the watchdog resets the CPU up to
+// WATCHDOG_TIMEOUT later. Interrupts left off stop it just the same.
+// Work that holds the CPU longer on purpose, like a motor move, calls
+// WatchdogProgress() as it goes. The other tasks can't run meanwhile,
+// so that counts as a check-in for all of them.
+//
+// The task being dispatched and the first one found late are kept in
+// .noinit, which a watchdog reset leaves as it was. After one,
+// WatchdogOn() copies them to EEPROM with a count of watchdog resets,
+// so watchdog_record has the latest watchdog reset even after a power
+// cycle, along with what caused this reset.
+
+#define WATCHDOG_NONE 0xFF	// No task
+
+typedef struct watchdog_log {
+	uint8_t cause;		// MCUSR after the reset: PORF, EXTRF, BORF, WDRF
+	uint8_t task;		// Running at the latest watchdog reset
+	uint8_t late;		// First found late before it
+	uint8_t count;		// Watchdog resets, saturating
+} watchdog_log;
+
+#ifdef WATCHDOG_TIMEOUT
+
+#ifndef WATCHDOG_SLACK_MS
+#define WATCHDOG_SLACK_MS 500
+#endif
+
+// Longest task period the 16 bit due times can supervise: a task just
+// checked in must still read as due ahead of tasksNow, not behind it.
+// TaskSetPeriod() refuses anything longer.
+#define WATCHDOG_PERIOD_MAX ((0x7FFF - WATCHDOG_SLACK_MS) / 2)
+#define WATCHDOG_CHECK(fn, st, ms, ph) \
+	_Static_assert((ms) <= WATCHDOG_PERIOD_MAX, #fn " period is too long for the watchdog");
+TASK_TABLE(WATCHDOG_CHECK)
+#undef WATCHDOG_CHECK
+
+#ifdef SIM_H
+#define WATCHDOG_NOINIT SIM_NOINIT
+#else
+#define WATCHDOG_NOINIT __attribute__((section(".noinit")))
+#endif
+
+uint8_t watchdog_mcusr WATCHDOG_NOINIT;	// MCUSR as the reset left it
+uint8_t watchdog_task WATCHDOG_NOINIT;	// Being dispatched
+uint8_t watchdog_late WATCHDOG_NOINIT;	// Found late since the last feed
+volatile uint8_t watchdog_busy;		// WatchdogProgress() since the last pass
+uint16_t watchdog_due[TASKS_COUNT];	// ms each task has to check in by
+watchdog_log watchdog_record;
+static watchdog_log EEMEM watchdog_eeprom = { 0, WATCHDOG_NONE, WATCHDOG_NONE, 0 };
+
+// A watchdog reset leaves the watchdog running at its shortest timeout,
+// 16 ms, and the start-up code outlasts that: StackPaint() in stack.h
+// alone takes about 11 ms at 8 MHz and 90 ms at 1 MHz. So MCUSR is kept
+// and the watchdog stopped first thing after reset, in .init0, ahead of
+// the paint. r1 and the stack pointer aren't set up yet, so no C; WDRF
+// has to be cleared before WDE can be.
+#ifndef SIM_H
+void watchdog_boot(void) __attribute__((naked, used, section(".init0")));
+void watchdog_boot(void) {
+	__asm__ __volatile__ (
+		"	in r24, %0\n"
+		"	sts watchdog_mcusr, r24\n"
+		"	clr r25\n"
+		"	out %0, r25\n"
+		"	ldi r24, %2\n"
+		"	sts %1, r24\n"
+		"	sts %1, r25\n"
+		:: "I" (_SFR_IO_ADDR(MCUSR)), "n" (_SFR_MEM_ADDR(WDTCSR)),
+		   "M" ((1 << WDCE) | (1 << WDE)));
+}
+#else
+void watchdog_boot(void) {
+	watchdog_mcusr = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Logs a watchdog reset to EEPROM and starts the
+//watchdog. Called by TimerOn().
+void WatchdogOn() {
+	unsigned char i;
+	uint16_t now;
+#ifdef SIM_H
+	watchdog_boot();
+#endif
+	eeprom_read_block(&watchdog_record, &watchdog_eeprom, sizeof(watchdog_record));
+	if (watchdog_record.count == 0xFF) {
+		// Erased
+		watchdog_record.task = WATCHDOG_NONE;
+		watchdog_record.late = WATCHDOG_NONE;
+		watchdog_record.count = 0;
+	}
+	if (watchdog_mcusr & (1 << WDRF)) {
+		watchdog_record.cause = watchdog_mcusr;
+		watchdog_record.task = watchdog_task;
+		watchdog_record.late = watchdog_late;
+		if (watchdog_record.count < 0xFE) {
+			watchdog_record.count++;
+		}
+		eeprom_update_block(&watchdog_record, &watchdog_eeprom, sizeof(watchdog_record));
+	}
+	watchdog_record.cause = watchdog_mcusr;
+	watchdog_task = WATCHDOG_NONE;
+	watchdog_late = WATCHDOG_NONE;
+	now = ClockMs();
+	for (i = 0; i < TASKS_COUNT; i++) {
+		watchdog_due[i] = now + 2 * TaskPeriodMs(i) + WATCHDOG_SLACK_MS;
+	}
+	wdt_enable(WATCHDOG_TIMEOUT);
+}
+
+// Task i is about to run
+#define WatchdogRun(i) (watchdog_task = (i))
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Task i has returned from a tick
+void WatchdogCheckIn(unsigned char i) {
+	uint16_t due = ClockMs() + 2 * TaskPeriodMs(i) + WATCHDOG_SLACK_MS;
+	watchdog_task = WATCHDOG_NONE;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		watchdog_due[i] = due;
+	}
+}
+
+//Functionality - The running task is still getting somewhere. One
+//store, cheap enough for every motor step.
+#define WatchdogProgress() (watchdog_busy = 1)
+
+////////////////////////////////////////////////////////////////////////////////
+//Functionality - Feeds the watchdog if no task is late. From the
+//scheduler interrupt, where tasksNow is current; the due times are
+//worked out at check-in so this pass only compares.
+void WatchdogSupervise() {
+	uint16_t now = tasksNow;
+	unsigned char i;
+	for (i = 0; i < TASKS_COUNT; i++) {
+		if (watchdog_busy) {
+			// The others get WATCHDOG_SLACK_MS from here to run again
+			if ((int16_t)(now + WATCHDOG_SLACK_MS - watchdog_due[i]) > 0) {
+				watchdog_due[i] = now + WATCHDOG_SLACK_MS;
+			}
+		}
+		else if ((int16_t)(now - watchdog_due[i]) > 0) {
+			if (watchdog_late == WATCHDOG_NONE) {
+				watchdog_late = i;
+			}
+			return;
+		}
+	}
+	watchdog_busy = 0;
+	watchdog_late = WATCHDOG_NONE;
+	wdt_reset();
+}
+
+#else
+
+#define WATCHDOG_PERIOD_MAX 0x7FFF
+#define WatchdogOn()
+#define WatchdogRun(i)
+#define WatchdogCheckIn(i)
+#define WatchdogProgress()
+#define WatchdogSupervise()
+
+#endif
+
+#endif //WATCHDOG_H
@@ -9,14 +9,35 @@
 #include <string.h>
 #include "nrf24.h"
 #include "lcd.h"
+
+/* Tasks: tick function, initial state, period and phase in ms */
+#define TASK_TABLE(X) \
+    X(tick_nrf,  NRF_RCV, 100, 0) \
+    X(tick_btn,  IN_WAIT, 100, 0) \
+    X(tick_disp, -1,      100, 0) \
+    X(tick_menu, IN_WAIT, 100, 0)
+// Tasks released together run in table order, so the buttons are read
+// before the slow LCD writes
+//
+// Idle between deadlines rather than waking every ms
+#define SCHED_TICKLESS
 #include "scheduler.h"
-#include "bit.h"
+#include "bench.h"
+#include "latency.h"
+#include "pin.h"
+// Paints the stack for a debugger to read the high-water mark from
+#include "stack.h"
+/* Start-up phases, see boot.h */
+#define BOOT_PHASES(X) \
+    X(LCD) X(RADIO) X(DISPLAY) X(SCHEDULER) X(READY) X(COMMAND)
+#include "boot.h"
 
 #define DEG_SYM 0xDF
 
-#define OPEN_BTN  7
-#define CLOSE_BTN 6
-#define SET_BTN   5
+// Buttons on PORTC, pulled low while pressed
+#define OPEN_BTN  C, 7
+#define CLOSE_BTN C, 6
+#define SET_BTN   C, 5
 
 #define NO_CONN 0
 #define CLOSED  1
@@ -25,6 +46,28 @@
 #define OPENING 4
 #define OPEN_PARTIAL 5
 
+// Commands beyond OPEN and CLOSED
+#define CMD_AUTO     3
+#define CMD_STATS    4
+// Status byte of a task statistics reply, or'd with the task number
+#define STATS_TAG    0x40
+#define STATS_TASKS  8
+// Status byte of a reset report, or'd with the watchdog resets up to 15
+#define RESET_TAG    0x50
+// Task number the window reports for none
+#define NO_TASK      0xFF
+// Temperature the window sends for a failed sensor
+#define TEMP_FAULT   -128
+// Window reset causes, its MCUSR bits
+#define RESET_POWER    (1 << 0)
+#define RESET_PIN      (1 << 1)
+#define RESET_BROWNOUT (1 << 2)
+#define RESET_WATCHDOG (1 << 3)
+// Ticks the statistics page stays up
+#define STATS_SHOW   30
+// Longest wait for the radio to take a packet, in ms
+#define NRF_TX_TIMEOUT 50
+
 static uint8_t _tx_address[5] = {0xD7,0xD7,0xD7,0xD7,0xD7};
 static uint8_t _rx_address[5] = {0xE7,0xE7,0xE7,0xE7,0xE7};
 static int8_t _rcv_buffer[4];
@@ -41,25 +84,58 @@ static uint8_t _max_set = 0;
 static uint8_t _auto = 0;
 static uint8_t _data_rcvd = 0;
 static uint8_t _rf_output = 0;
+/* Window task statistics: longest tick ms, overruns, misses */
+static uint8_t _win_stats[STATS_TASKS][3];
+static uint8_t _stats_rcvd = 0;
+/* Window reset report: cause, task at the latest watchdog reset, tag,
+ * task found late before it */
+static uint8_t _win_reset[4];
+static uint8_t _reset_rcvd = 0;
 
 int send_rx(uint8_t *buffer) {
     uint8_t result;
+    unsigned long start;
     nrf24_send(buffer);
-    while (!nrf24_isSending());
+    start = ClockMs();
+    while (nrf24_isSending() && !ClockExpired(start, NRF_TX_TIMEOUT));
 
     result = nrf24_retransmissionCount();
     nrf24_powerUpRx();
     return result;
 }
 
-/* Updates display using the current received temperatures */
+/*
+ * Sends OPEN or CLOSED to the window with the next sequence number and
+ * traces its latency. The window gets the sequence number and the ms
+ * since the last button poll that saw nothing pressed.
+ */
+int send_command(uint8_t command) {
+    static uint8_t seq;
+    int result;
+    seq = seq == 0xFF ? 1 : seq + 1;
+    LatencyBegin(seq, LATENCY_RELEASED, 0);
+    LatencyMark(LATENCY_PRESSED);
+    _send_buffer[0] = command;
+    _send_buffer[1] = seq;
+    _send_buffer[2] = LatencyMs();
+    LatencyMark(LATENCY_SENT);
+    result = send_rx(_send_buffer);
+    LatencyMark(LATENCY_ACKED);
+    LatencyEnd();
+    BootMark(BOOT_COMMAND);
+    return result;
+}
+
+/* Updates display using the current received temperatures, -- for
+ * none or a failed sensor */
 void update_display(void) {
     static char temp[5];
     uint8_t cursor = 1;
+    BENCH_BEGIN(DISPLAY);
     LCD_ClearScreen();
     LCD_DisplayString(cursor, "in:");
     cursor += 3;
-    if (_data_rcvd) {
+    if (_data_rcvd && _temp_in != TEMP_FAULT) {
         itoa(_temp_in, temp, 10);
         LCD_DisplayString(cursor, temp);
         cursor += strlen(temp);
@@ -72,7 +148,7 @@ void update_display(void) {
     cursor = 9;
     LCD_DisplayString(cursor, "out:");
     cursor += 4;
-    if (_data_rcvd) {
+    if (_data_rcvd && _temp_out != TEMP_FAULT) {
         itoa(_temp_out, temp, 10);
         LCD_DisplayString(cursor, temp);
         cursor += strlen(temp);
@@ -117,12 +193,70 @@ void update_display(void) {
     }
 
     LCD_Cursor(0);
+    BENCH_END(DISPLAY);
+}
+
+/* Shows the window task with the longest tick */
+void stats_display(void) {
+    static char temp[5];
+    uint8_t i;
+    uint8_t worst = 0;
+    for (i = 1; i < STATS_TASKS; i++) {
+        if (_win_stats[i][0] > _win_stats[worst][0]) {
+            worst = i;
+        }
+    }
+    LCD_ClearScreen();
+    LCD_DisplayString(1, "task");
+    itoa(worst, temp, 10);
+    LCD_DisplayString(5, temp);
+    LCD_DisplayString(7, "max");
+    itoa(_win_stats[worst][0], temp, 10);
+    LCD_DisplayString(11, temp);
+    LCD_DisplayString(11 + strlen(temp), "ms");
+    LCD_DisplayString(17, "ovr");
+    itoa(_win_stats[worst][1], temp, 10);
+    LCD_DisplayString(21, temp);
+    LCD_DisplayString(25, "miss");
+    itoa(_win_stats[worst][2], temp, 10);
+    LCD_DisplayString(30, temp);
+    LCD_Cursor(0);
+}
+
+/* Shows why the window last reset and its latest watchdog reset */
+void reset_display(void) {
+    static char temp[5];
+    uint8_t cause = _win_reset[0];
+    LCD_ClearScreen();
+    LCD_DisplayString(1, "reset");
+    if (cause & RESET_WATCHDOG) {
+        LCD_DisplayString(7, "watchdog");
+    }
+    else if (cause & RESET_BROWNOUT) {
+        LCD_DisplayString(7, "brown-out");
+    }
+    else if (cause & RESET_PIN) {
+        LCD_DisplayString(7, "pin");
+    }
+    else if (cause & RESET_POWER) {
+        LCD_DisplayString(7, "power");
+    }
+    LCD_DisplayString(17, "wdt");
+    itoa(_win_reset[2] & 0x0F, temp, 10);
+    LCD_DisplayString(21, temp);
+    LCD_DisplayString(24, "task");
+    temp[0] = _win_reset[1] == NO_TASK ? '-' : '0' + _win_reset[1];
+    temp[1] = '/';
+    temp[2] = _win_reset[3] == NO_TASK ? '-' : '0' + _win_reset[3];
+    temp[3] = 0;
+    LCD_DisplayString(29, temp);
+    LCD_Cursor(0);
 }
 
 /* Update the display if any of the state variables used in the
  * display are updated
  */
-enum disp_states { DISP_DEF, DISP_MIN_SET, DISP_MAX_SET };
+enum disp_states { DISP_DEF, DISP_MIN_SET, DISP_MAX_SET, DISP_STATS };
 int tick_disp(int state) {
     static uint8_t prev_status;
     static uint8_t prev_auto;
@@ -131,9 +265,23 @@ int tick_disp(int state) {
 
     static int8_t prev_temp;
     static char temp[5];
+    static uint8_t shown;
     switch (state) {
         case DISP_DEF:
-            if (_min_set) {
+            if (_stats_rcvd) {
+                _stats_rcvd = 0;
+                shown = 0;
+                state = DISP_STATS;
+                stats_display();
+            }
+            // Shown for as long as the statistics
+            else if (_reset_rcvd) {
+                _reset_rcvd = 0;
+                shown = 0;
+                state = DISP_STATS;
+                reset_display();
+            }
+            else if (_min_set) {
                 state = DISP_MIN_SET;
                 LCD_ClearScreen();
                 LCD_DisplayString(1, "min temp:");
@@ -180,12 +328,32 @@ int tick_disp(int state) {
                 LCD_Cursor(0);
             }
             break;
+        case DISP_STATS:
+            if (_stats_rcvd) {
+                _stats_rcvd = 0;
+                shown = 0;
+                stats_display();
+            }
+            else if (++shown >= STATS_SHOW) {
+                update_display();
+                state = DISP_DEF;
+            }
+            break;
         default:
+#ifdef BOOT_FAST
+            // The LCD is started here rather than in main(), see there
+            if (ClockMs() < LCD_POWER_UP_MS) {
+                break;
+            }
+            LCD_Start();
+            BootMark(BOOT_LCD);
+#endif
             prev_status = _status;
             prev_auto = _auto;
             prev_in = _temp_in;
             prev_out = _temp_out;
             update_display();
+            BootMark(BOOT_DISPLAY);
             state = DISP_DEF;
             break;
     }
@@ -200,20 +368,20 @@ enum input_states { IN_WAIT, IN_CLOSE, IN_OPEN, IN_SET, IN_SET_MIN, IN_SET_MAX }
 int tick_menu(int state) {
     switch (state) {
         case IN_WAIT:
-            if ( !GetBit(PINC, SET_BTN) ) {
+            if ( !PIN_READ(SET_BTN) ) {
                 _min_set = 1;
                 state = IN_SET;
             }
             break;
         case IN_SET:
-            if ( GetBit(PINC, SET_BTN)  && _min_set) {
+            if ( PIN_READ(SET_BTN)  && _min_set) {
                 state = IN_SET_MIN;
             }
-            else if ( GetBit(PINC, SET_BTN)  && _max_set) {
+            else if ( PIN_READ(SET_BTN)  && _max_set) {
                 state = IN_SET_MAX;
             }
-            else if ( GetBit(PINC, SET_BTN)  && _auto_set) {
-                _send_buffer[0] = 3;
+            else if ( PIN_READ(SET_BTN)  && _auto_set) {
+                _send_buffer[0] = CMD_AUTO;
                 _send_buffer[1] = _temp_max;
                 _send_buffer[2] = _temp_min;
                 send_rx(_send_buffer);
@@ -221,7 +389,7 @@ int tick_menu(int state) {
             }
             break;
         case IN_SET_MIN:
-            if ( !GetBit(PINC, SET_BTN) ) {
+            if ( !PIN_READ(SET_BTN) ) {
                 if (_temp_max == -1 || (_temp_max < (_temp_max + 3))) {
                     _temp_max = _temp_min + 3;
                 }
@@ -229,26 +397,26 @@ int tick_menu(int state) {
                 _max_set = 1;
                 state = IN_SET;
             }
-            else if ( !GetBit(PINC, CLOSE_BTN) ) {
+            else if ( !PIN_READ(CLOSE_BTN) ) {
                 _temp_min = _temp_min < 100 ? _temp_min + 1 : _temp_min;
                 state = IN_SET;
             }
-            else if ( !GetBit(PINC, OPEN_BTN) ) {
+            else if ( !PIN_READ(OPEN_BTN) ) {
                 _temp_min = _temp_min > 0 ? _temp_min - 1 : _temp_min;
                 state = IN_SET;
             }
             break;
         case IN_SET_MAX:
-            if ( !GetBit(PINC, SET_BTN) ) {
+            if ( !PIN_READ(SET_BTN) ) {
                 _max_set = 0;
                 _auto_set = 1;
                 state = IN_SET;
             }
-            else if ( !GetBit(PINC, CLOSE_BTN) ) {
+            else if ( !PIN_READ(CLOSE_BTN) ) {
                 _temp_max = _temp_max < 110 ? _temp_max + 1 : _temp_max;
                 state = IN_SET;
             }
-            else if ( !GetBit(PINC, OPEN_BTN) ) {
+            else if ( !PIN_READ(OPEN_BTN) ) {
                 _temp_max = _temp_max > (_temp_min + 3)  ? _temp_max - 1 : _temp_max;
                 state = IN_SET;
             }
@@ -262,25 +430,34 @@ int tick_menu(int state) {
 
 int tick_btn(int state) {
     static uint8_t temp;
+    BootMark(BOOT_READY);
     switch (state) {
         case IN_WAIT:
-            if ( !GetBit(PINC, OPEN_BTN)  && !_min_set && !_max_set) {
+            // Both buttons at once asks the window for its task statistics
+            if ( !PIN_READ(OPEN_BTN) && !PIN_READ(CLOSE_BTN) ) {
+                state = IN_SET;
+                _send_buffer[0] = CMD_STATS;
+                send_rx(_send_buffer);
+            }
+            else if ( !PIN_READ(OPEN_BTN)  && !_min_set && !_max_set) {
                 state = IN_SET;
-                _send_buffer[0] = OPEN;
-                if (send_rx(_send_buffer) == NRF24_MESSAGE_LOST) {
+                if (send_command(OPEN) == NRF24_MESSAGE_LOST) {
                     _status = NO_CONN;
                 }
             }
-            else if ( !GetBit(PINC, CLOSE_BTN) && !_min_set && !_max_set) {
+            else if ( !PIN_READ(CLOSE_BTN) && !_min_set && !_max_set) {
                 state = IN_SET;
-                _send_buffer[0] = CLOSED;
-                if (send_rx(_send_buffer) == NRF24_MESSAGE_LOST) {
+                if (send_command(CLOSED) == NRF24_MESSAGE_LOST) {
                     _status = NO_CONN;
                 }
             }
+            else {
+                // A press turning up later came after this poll
+                LatencyIdle();
+            }
             break;
         case IN_SET:
-            if (GetBit(PINC, OPEN_BTN)) {
+            if (PIN_READ(OPEN_BTN)) {
                 state = IN_WAIT;
             }
             break;
@@ -297,11 +474,28 @@ int tick_btn(int state) {
 enum nrf_states { NRF_RCV, NRF_SEND, NRF_WAIT };
 
 int tick_nrf(int state) {
+    uint8_t i;
     switch(state) {
         case NRF_RCV:
-            if (nrf24_dataReady()) {
-                _data_rcvd = 1;
+            // Statistics replies come in a burst, drain them all
+            while (nrf24_dataReady()) {
                 nrf24_getData(_rcv_buffer);
+                if ((_rcv_buffer[2] & 0xF0) == STATS_TAG) {
+                    i = _rcv_buffer[2] & 0x0F;
+                    if (i < STATS_TASKS) {
+                        _win_stats[i][0] = _rcv_buffer[0];
+                        _win_stats[i][1] = _rcv_buffer[1];
+                        _win_stats[i][2] = _rcv_buffer[3];
+                        _stats_rcvd = 1;
+                    }
+                    continue;
+                }
+                if ((_rcv_buffer[2] & 0xF0) == RESET_TAG) {
+                    memcpy(_win_reset, _rcv_buffer, sizeof(_win_reset));
+                    _reset_rcvd = 1;
+                    continue;
+                }
+                _data_rcvd = 1;
                 _temp_in = _rcv_buffer[0];
                 _temp_out = _rcv_buffer[1];
                 _status = _rcv_buffer[2];
@@ -316,12 +510,22 @@ int tick_nrf(int state) {
 }
 
 
+TASKS_DEFINE();
+
 int main() {
     /* initialize lcd data and contorl ports */
     DDRD = 0xFF; PORTD = 0;
     DDRC = 0x1F; PORTC = 0xE0;
 
+    // Start time first, the LCD and radio delays run on it
+    ClockOn();
+    // The LCD's power up wait and its first screen take a quarter of a
+    // second. With BOOT_FAST tick_disp does both, so the buttons are
+    // read from the first tick.
+#ifndef BOOT_FAST
     LCD_init();
+    BootMark(BOOT_LCD);
+#endif
 
     /* Channel #2, payload length: 4 */
     nrf24_init();
@@ -330,37 +534,17 @@ int main() {
     /* Set the device addresses */
     nrf24_tx_address(_tx_address);
     nrf24_rx_address(_rx_address);
+    BootMark(BOOT_RADIO);
 
+#ifndef BOOT_FAST
     update_display();
+    BootMark(BOOT_DISPLAY);
+#endif
 
-    /* define tasks */
-    tasksNum = 4; // declare number of tasks
-    task tsks[4]; // initialize the task array
-    tasks = tsks; // set the task array
-
-    uint8_t i = 0;
-    tasks[i].state = NRF_RCV;
-    tasks[i].period = 100;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_nrf;
-    i++;
-    tasks[i].state = -1;
-    tasks[i].period = 100;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_disp;
-    i++;
-    tasks[i].state = IN_WAIT;
-    tasks[i].period = 100;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_btn;
-    i++;
-    tasks[i].state = IN_WAIT;
-    tasks[i].period = 100;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_menu;
-
-    TimerSet(100);
+    BootMark(BOOT_SCHEDULER);
     TimerOn();
 
-    while(1) {}
+    while(1) {
+        TasksDispatch();
+    }
 }
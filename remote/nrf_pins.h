@@ -0,0 +1,13 @@
+/*
+* Radio pins of the remote on PORTA, as pin.h descriptors for nrf24.h
+*/
+#ifndef NRF_PINS_H
+#define NRF_PINS_H
+
+#define NRF_CE   A, 0
+#define NRF_CSN  A, 1
+#define NRF_SCK  A, 2
+#define NRF_MOSI A, 3
+#define NRF_MISO A, 4
+
+#endif
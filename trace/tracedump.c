@@ -0,0 +1,169 @@
+// Permission to copy is granted provided that this header remains intact.
+// This software is provided with no warranties.
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Event trace decoder: reads the dump a firmware sends for the console's
+// trace command (see include/trace.h) and prints it as a timeline, one
+// event per line with the time in ms since the oldest one.
+//
+//     tracedump [file]
+//
+// Reads stdin without a file, e.g. the output of the host build, or a
+// serial port set up beforehand:
+//
+//     stty -F /dev/ttyUSB0 38400 raw && printf 'trace\r' > /dev/ttyUSB0 &&
+//         tracedump /dev/ttyUSB0
+//
+// Anything before the magic is skipped, so a dump can be picked out of
+// other output. Exits non-zero if no whole dump came in or the sum
+// doesn't match.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TRACE_HOST
+#include "trace.h"
+
+#define TRACE_IDS 256
+
+static const char *trace_names[TRACE_IDS];
+
+typedef struct trace_entry {
+	uint8_t id, arg;
+	uint16_t time;
+} trace_entry;
+
+static FILE *in;
+static uint8_t sum;
+
+// Next byte of the dump, counted into the sum. Returns -1 at the end.
+static int trace_byte(void) {
+	int c = getc(in);
+	if (c != EOF) {
+		sum += c;
+	}
+	return c;
+}
+
+// Little endian field of n bytes
+static int trace_field(unsigned long *v, int n) {
+	int i, c;
+	*v = 0;
+	for (i = 0; i < n; i++) {
+		if ((c = trace_byte()) < 0) {
+			return 0;
+		}
+		*v |= (unsigned long)c << (8 * i);
+	}
+	return 1;
+}
+
+// Skips input up to and including the magic. Returns 0 if it never came.
+static int trace_sync(void) {
+	const char *magic = TRACE_MAGIC;
+	size_t matched = 0;
+	int c;
+	while (magic[matched] && (c = getc(in)) != EOF) {
+		if (c == magic[matched]) {
+			matched++;
+		}
+		else {
+			matched = c == magic[0];
+		}
+	}
+	return !magic[matched];
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long version, rate, count, i, id, arg, time;
+	unsigned long long epoch = 0, last = 0, now, first = 0;
+	trace_entry *events;
+	int c;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [file]\n", argv[0]);
+		return 2;
+	}
+	in = argc == 2 ? fopen(argv[1], "rb") : stdin;
+	if (!in) {
+		fprintf(stderr, "tracedump: can't read %s\n", argv[1]);
+		return 2;
+	}
+#define TRACE_NAME(name, id) trace_names[id] = #name;
+	TRACE_EVENTS(TRACE_NAME)
+#undef TRACE_NAME
+
+	if (!trace_sync()) {
+		fprintf(stderr, "tracedump: no trace in the input\n");
+		return 1;
+	}
+	if (!trace_field(&version, 1) || !trace_field(&rate, 4) || !trace_field(&count, 2)) {
+		fprintf(stderr, "tracedump: the header is cut short\n");
+		return 1;
+	}
+	if (version != TRACE_VERSION || !rate) {
+		fprintf(stderr, "tracedump: can't read version %lu dumps\n", version);
+		return 1;
+	}
+	events = calloc(count + 1, sizeof(*events));
+	for (i = 0; i < count; i++) {
+		if (!trace_field(&id, 1) || !trace_field(&arg, 1) || !trace_field(&time, 2)) {
+			fprintf(stderr, "tracedump: cut short after %lu of %lu events\n", i, count);
+			return 1;
+		}
+		events[i].id = id;
+		events[i].arg = arg;
+		events[i].time = time;
+	}
+	c = sum;
+	if (!trace_field(&id, 1)) {
+		fprintf(stderr, "tracedump: the sum is missing\n");
+		return 1;
+	}
+	if (id != (uint8_t)c) {
+		fprintf(stderr, "tracedump: bad sum, %02lx instead of %02x\n", id, c);
+		return 1;
+	}
+
+	// Rebuild the counter above 16 bits. A wrap record carries the low
+	// byte of the overflow count, so events before the first one are
+	// in the overflow before it. Between wraps time only moves forward,
+	// which also covers an event that caught the counter past a wrap
+	// whose interrupt hadn't run yet.
+	for (i = 0; i < count && events[i].id != TRACE_CYCLE_WRAP; i++);
+	if (i < count) {
+		epoch = 0x100 + events[i].arg - (i > 0);
+	}
+	printf("# %lu events, %lu counts per second\n", count, rate);
+	printf("#       ms  event        arg\n");
+	for (i = 0; i < count; i++) {
+		if (events[i].id == TRACE_CYCLE_WRAP) {
+			epoch = (epoch & ~0xFFULL) | events[i].arg;
+			if ((epoch << 16 | events[i].time) < last) {
+				epoch += 0x100;
+			}
+		}
+		now = epoch << 16 | events[i].time;
+		while (now < last) {
+			now += 0x10000;
+			epoch++;
+		}
+		if (!i) {
+			first = now;
+		}
+		last = now;
+		if (trace_names[events[i].id]) {
+			printf("%10.3f  %-12s %u\n", (now - first) * 1000.0 / rate,
+				trace_names[events[i].id], events[i].arg);
+		}
+		else {
+			printf("%10.3f  %-12u %u\n", (now - first) * 1000.0 / rate,
+				events[i].id, events[i].arg);
+		}
+	}
+	free(events);
+	return 0;
+}
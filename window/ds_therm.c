@@ -3,60 +3,69 @@
  * Adapted from: http://teslabs.com/openplayer/docs/docs/other/ds18b20_pre1.pdf
  */
 #include "ds18b20.h"
-
-
-inline __attribute__((gnu_inline)) void therm_delay(uint16_t delay) {
-    while (delay--) asm volatile("nop");
-}
+#include "bench.h"
+#include "clock.h"
+#include "trace.h"
+#include <util/atomic.h>
 
 uint8_t therm_reset(uint8_t pin) {
     uint8_t i;
     // Pull line low and wait for 480us
     THERM_LOW(pin);
     THERM_OUTPUT_MODE(pin);
-    therm_delay(us(480));
-
-    // Release line and wait for 60 us
-    THERM_INPUT_MODE(pin);
-    therm_delay(us(60));
+    DELAY_US(480);
+
+    // Release line and wait for 60 us, sampling the presence pulse
+    // before an interrupt can push it past the window
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        THERM_INPUT_MODE(pin);
+        DELAY_US(60);
+        i = THERM_READ(pin);
+    }
 
-    // Store line value and wait until the completion of 480us period
-    i = (THERM_PIN & (1 << pin));
-    therm_delay(us(420));
+    // Wait until the completion of 480us period
+    DELAY_US(420);
 
     // Return the value read from the presence pulse
     return i;
 }
 
 void therm_write_bit(uint8_t bit, uint8_t pin) {
-    // pull line low for 1 us
-    THERM_LOW(pin);
-    THERM_OUTPUT_MODE(pin);
-    therm_delay(us(1));
-
-    if (bit) THERM_INPUT_MODE(pin);
-
-    therm_delay(us(60));
-    THERM_INPUT_MODE(pin);
+    // The whole slot is timed, an interrupt in it would stretch the
+    // low pulse of a 1 into a 0
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // pull line low for 1 us
+        THERM_LOW(pin);
+        THERM_OUTPUT_MODE(pin);
+        DELAY_US(1);
+
+        if (bit) THERM_INPUT_MODE(pin);
+
+        DELAY_US(60);
+        THERM_INPUT_MODE(pin);
+    }
 }
 
 uint8_t therm_read_bit(uint8_t pin) {
     uint8_t bit = 0;
 
-    // Pull line low for 1 us
-    THERM_LOW(pin);
-    THERM_OUTPUT_MODE(pin);
-    therm_delay(us(1));
+    // The sample must land within 15 us of the falling edge
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Pull line low for 1 us
+        THERM_LOW(pin);
+        THERM_OUTPUT_MODE(pin);
+        DELAY_US(1);
 
-    // Release the line adn wait for 14 us
-    THERM_INPUT_MODE(pin);
-    therm_delay(us(14));
+        // Release the line adn wait for 14 us
+        THERM_INPUT_MODE(pin);
+        DELAY_US(14);
 
-    // Reade line value
-    if (THERM_PIN & (1 << pin)) bit = 1;
+        // Reade line value
+        if (THERM_READ(pin)) bit = 1;
+    }
 
     // Wait for 45 us to end and return read value
-    therm_delay(us(45));
+    DELAY_US(45);
     return bit;
 }
 
@@ -79,18 +88,30 @@ void therm_write_byte(uint8_t byte, uint8_t pin) {
     }
 }
 
-int8_t therm_read_temperature(uint8_t pin) {
+/* Starts a temperature conversion, which takes up to 750 ms. Returns
+ * non-zero if no sensor answered the reset. */
+uint8_t therm_convert(uint8_t pin) {
+    uint8_t missing;
+    TRACE(THERM_START, pin);
+    // Reset, skip ROM and start temperature conversion
+    missing = therm_reset(pin);
+    therm_write_byte(THERM_CMD_SKIPROM, pin);
+    therm_write_byte(THERM_CMD_CONVERTTEMP, pin);
+    return missing;
+}
+
+/* Non-zero once the conversion started by therm_convert() is done */
+uint8_t therm_converted(uint8_t pin) {
+    return therm_read_bit(pin);
+}
+
+/* Reads the result of a finished conversion in degrees F */
+int8_t therm_read_result(uint8_t pin) {
     // Buffer length must be at least 12 bytes long
     uint8_t temperature[2];
     int8_t digit;
     uint16_t decimal;
 
-    // Reset, skip ROM and start temperature conversion
-    therm_reset(pin);
-    therm_write_byte(THERM_CMD_SKIPROM, pin);
-    therm_write_byte(THERM_CMD_CONVERTTEMP, pin);
-    // wait until conversion is complete
-    while (!therm_read_bit(pin));
     // reset, skip ROM and send command to read scratchpad
     therm_reset(pin);
     therm_write_byte(THERM_CMD_SKIPROM, pin);
@@ -112,5 +133,20 @@ int8_t therm_read_temperature(uint8_t pin) {
         digit += 1;
     }
 
-    return (digit * 9 / 5) + 32;
+    digit = (digit * 9 / 5) + 32;
+    TRACE(THERM_DONE, digit);
+    return digit;
+}
+
+int8_t therm_read_temperature(uint8_t pin) {
+    unsigned long start;
+    int8_t result;
+    BENCH_BEGIN(THERM_READ);
+    therm_convert(pin);
+    // wait until conversion is complete, a shorted bus never ends it
+    start = ClockMs();
+    while (!therm_converted(pin) && !ClockExpired(start, THERM_CONVERT_MS));
+    result = therm_read_result(pin);
+    BENCH_END(THERM_READ);
+    return result;
 }
@@ -8,29 +8,102 @@
 #include <stdint.h>
 #include <string.h>
 #include "nrf24.h"
+
+/* Tasks: tick function, initial state, period and phase in ms. Tasks
+ * that switch between a fast and a slow period start at their idle one,
+ * ALERT_SLOW and AUTO_SLOW; the radio starts fast, see NRF_FAST_POLLS. */
+#define TASK_TABLE(X) \
+    X(tick_temp,    TASK_START, 3000, 0) \
+    X(tick_nrf,     NRF_SEND,   100,  0) \
+    X(tick_alert,   WAIT,       300,  0) \
+    X(tick_auto,    AUTO_OFF,   1000, 0) \
+    X(tick_console, TASK_START, 100,  0) \
+    BOOT_TASKS(X)
+#ifdef BOOT_FAST
+// Homes the window after the first status has gone out, see main(),
+// then parks at BOOT_PARKED
+#define BOOT_PARKED   3000
+#define BOOT_TASKS(X) X(tick_boot, TASK_START, BOOT_PARKED, 100)
+#else
+#define BOOT_TASKS(X)
+#endif
+// Spread the tasks over quarters of the 100 ms tick
+#define SCHED_PHASE_SLOTS 4
+// Reset if a task stops checking in, see watchdog.h
+#define WATCHDOG_TIMEOUT WDTO_2S
 #include "scheduler.h"
 #include "ds18b20.h"
-#include "bit.h"
-#include "adc.H"
+#include "pin.h"
+#include "ring.h"
+#include "adc.h"
+#include "latency.h"
+#include "trace.h"
+#include "stack.h"
+#include <avr/eeprom.h>
 
-#define F_CPU 8000000UL // 8 MHz
 #include <util/delay.h>
 
+/* Start-up phases, see boot.h */
+#define BOOT_PHASES(X) \
+    X(RADIO) X(HOMED) X(TEMPS) X(SCHEDULER) X(READY) X(COMMAND)
+#include "boot.h"
+
 #define MAX_OUT_TEMP 80
-#define STEP_PIN     0
-#define DIR_PIN      1
-#define SLEEP_PIN    2
+// Stepper driver on PORTC
+#define STEP_PIN     C, 0
+#define DIR_PIN      C, 1
+#define SLEEP_PIN    C, 2
 
-#define CLOSE_PIN    1
-#define OPEN_PIN     0
+// Buttons on PORTD, pulled low while pressed
+#define CLOSE_PIN    D, 1
+#define OPEN_PIN     D, 0
+// Sensor fault LED
+#define ALERT_PIN    B, 2
 
 #define CLOSE_DIR    1
 #define OPEN_DIR     0
 
+// Force sensor input on PORTA and the reading that means the window is
+// seated when no calibration has been stored, scaled to the oversampled
+// ADC resolution
+#define FORCE_PIN    0
+#define FORCE_CLOSED (100 << ADC_OVERSAMPLE_BITS)
+
+// Half step times in us. Closing runs at CLOSE_WAIT_FAST until the
+// learned contact zone, then drops to CLOSE_WAIT_SLOW. Without a
+// calibration it never gets faster than CLOSE_WAIT_SAFE. These are the
+// defaults, the console can change them.
+#define WAIT_START      1000
+#define OPEN_WAIT_FAST  300
+#define CLOSE_WAIT_FAST 300
+#define CLOSE_WAIT_SAFE 400
+#define CLOSE_WAIT_SLOW 700
+// Steps allowed past the closed position before giving up on the sensor
+#define CLOSE_EXTRA     400
+
+// Calibration tuning
+#define CAL_MAGIC    0xA5
+#define CAL_WAIT     1000                           // half step while learning
+#define CAL_SAMPLES  16                             // reads averaged for baseline
+#define CAL_TOUCH    (8 << ADC_OVERSAMPLE_BITS)     // rise that counts as contact
+#define CAL_SETTLE   20                             // steps without a new peak
+#define CAL_MARGIN   100                            // extra slow steps before contact
+#define CAL_BACKOFF  400                            // steps opened before learning
+// Steps between yields while homing from tick_boot. The motor pauses
+// while other tasks run, so it steps at _close_wait_slow, which needs
+// no ramp to start from rest.
+#define HOME_SLICE   12
+
 // Steps in a revolution
 #define STEPS_REV    200
-// Revolutions to open or close fully
+// Revolutions to open or close fully until the travel has been learned
 #define REV_OPEN     30
+#define TRAVEL_DEFAULT ((uint16_t)STEPS_REV * REV_OPEN)
+// Longest travel accepted while learning
+#define TRAVEL_MAX   ((uint16_t)STEPS_REV * 100)
+// Optional open end switch on PORTD, pulled low at the open limit. PD2
+// and PD3 are left to the UART.
+#define OPEN_LIMIT_PIN D, 4
 
 #define NO_CONN 0
 #define CLOSED  1
@@ -39,6 +112,35 @@
 #define OPENING 4
 #define OPEN_PARTIAL 5
 
+// Remote commands beyond OPEN and CLOSED
+#define CMD_AUTO     3
+#define CMD_STATS    4
+// Status byte of a task statistics reply, or'd with the task number
+#define STATS_TAG    0x40
+// Status byte of a reset report, or'd with the watchdog resets up to 15
+#define RESET_TAG    0x50
+
+// Task periods in ms, fast while there is something to react to and
+// slow while idle. The radio stays fast for NRF_FAST_POLLS polls after
+// a command or a move so the remote sees the new state quickly.
+#define NRF_FAST       100
+#define NRF_SLOW       300
+#define NRF_FAST_POLLS 30
+// Radio channel, the remote's must match
+#define NRF_CHANNEL    6
+// Longest wait for the radio to take a packet
+#define NRF_TX_TIMEOUT 50
+// Received packets queued for tick_nrf, a power of two
+#define RX_QUEUE       4
+#define ALERT_FAST     100
+#define ALERT_SLOW     300
+#define AUTO_FAST      500
+#define AUTO_SLOW      1000
+// tick_temp while it waits on the first reading
+#define TEMP_FIRST_POLL 100
+// Temperature sent for a sensor that didn't answer or never finished
+#define TEMP_FAULT     -128
+
 enum inputs {
     INPUT_CLOSE_ALL,
     INPUT_CLOSE,
@@ -47,119 +149,490 @@ enum inputs {
     INPUT_STOP
 };
 
+typedef struct radio_packet {
+    uint8_t data[4];
+} radio_packet;
+
 /* State machine variables */
 static uint8_t _send_buffer[4];
-static uint8_t _rcv_buffer[4];
+static radio_packet _rcv_packet;
+RING_DECLARE(_rx_queue, radio_packet, RX_QUEUE);
 static int8_t _temp_out;
 static int8_t _temp_in;
 static int8_t _temp_max;
 static int8_t _temp_min;
 static uint8_t _status = CLOSED;
+static uint8_t _after_home = 0;             // Last OPEN or CLOSED before homing
 static uint8_t _tx_address[5] = {0xE7,0xE7,0xE7,0xE7,0xE7};
 static uint8_t _rx_address[5] = {0xD7,0xD7,0xD7,0xD7,0xD7};
 static uint8_t _auto = 0;
-static uint8_t _revs = REV_OPEN;
-static uint8_t _steps = 0;
+static uint16_t _pos = TRAVEL_DEFAULT;      // steps from the closed position
+static uint16_t _travel = TRAVEL_DEFAULT;   // steps from closed to fully open
+static uint16_t EEMEM _travel_eeprom = 0xFFFF;
 static uint8_t _no_force_sensor = 0;
+static uint8_t _fast_polls = NRF_FAST_POLLS;
+static uint8_t _reset_report = 0;          // reset report for the remote to hear
+static uint8_t _therm_fault = 0;           // bit per failed sensor, see tick_temp
+
+/* Learned force sensor signature, kept in EEPROM */
+typedef struct window_cal {
+    uint8_t  magic;
+    uint16_t baseline;  // reading with nothing pressing on the sensor
+    uint16_t contact;   // reading once the window is seated
+    uint16_t zone;      // steps from the first rise to seated
+} window_cal;
+static window_cal EEMEM _cal_eeprom;
+static window_cal _cal;
+static uint16_t _force_closed = FORCE_CLOSED;
+static uint16_t _slow_steps = TRAVEL_DEFAULT;
+static uint16_t _close_extra = CLOSE_EXTRA;
+
+/* Stepper ramp in us per half step, see WAIT_START */
+static uint16_t _wait_start = WAIT_START;
+static uint16_t _open_wait_fast = OPEN_WAIT_FAST;
+static uint16_t _close_wait_fast = CLOSE_WAIT_FAST;
+static uint16_t _close_wait_safe = CLOSE_WAIT_SAFE;
+static uint16_t _close_wait_slow = CLOSE_WAIT_SLOW;
+
+/* Console on the UART, see console.h */
+#define CONSOLE_COMMANDS(X) \
+    X(stats,  console_stats,  "[clear]: task statistics") \
+    X(lat,    console_lat,    "command latency histograms") \
+    X(period, console_period, "[task ms]: task periods") \
+    X(test,   console_test,   "check the radio, sensors and force sensor") \
+    X(mem,    console_mem,    "static RAM and stack high-water mark") \
+    X(trace,  console_trace,  "binary event trace dump, see trace/") \
+    X(boot,   console_boot,   "when each start-up phase finished") \
+    X(wdt,    console_wdt,    "reset cause and the latest watchdog reset")
+#define CONSOLE_TUNABLES(X) \
+    X(auto,       _auto,            0,   1) \
+    X(temp_max,   _temp_max,        32,  110) \
+    X(temp_min,   _temp_min,        32,  110) \
+    X(wait_start, _wait_start,      100, 5000) \
+    X(open_fast,  _open_wait_fast,  100, 5000) \
+    X(close_fast, _close_wait_fast, 100, 5000) \
+    X(close_safe, _close_wait_safe, 100, 5000) \
+    X(close_slow, _close_wait_slow, 100, 5000)
+#include "console.h"
 
 #define CLOSE_IN() ( _rf_input == CLOSING || (PIND & 0x03) == 1 )
 #define OPEN_IN() ( _rf_input == OPENING || (PIND & 0x03) == 2 )
 
+/* Keep polling the radio fast for a while */
+void radio_active() {
+    _fast_polls = NRF_FAST_POLLS;
+    TaskSetPeriod(TASK_tick_nrf, NRF_FAST);
+}
+
+/*
+ * Moves packets waiting in the radio into _rx_queue. Stops while the
+ * queue is full, leaving the rest in the radio's own 3 deep FIFO.
+ * Traces the latency of numbered OPEN and CLOSED commands, see
+ * latency.h: byte 1 is the remote's sequence number and byte 2 its
+ * share in ms.
+ */
+void radio_poll() {
+    radio_packet packet;
+    uint8_t taken = 0;
+    while (!RING_FULL(_rx_queue) && nrf24_dataReady()) {
+        nrf24_getData(packet.data);
+        RING_PUSH(_rx_queue, packet);
+        taken = 1;
+        if ((packet.data[0] == OPEN || packet.data[0] == CLOSED) && packet.data[1]) {
+            LatencyBegin(packet.data[1], LATENCY_EMPTY, packet.data[2] * 1000UL);
+            LatencyMark(LATENCY_RECEIVED);
+        }
+    }
+    if (!taken && !RING_FULL(_rx_queue)) {
+        // A packet turning up later came after this poll
+        LatencyIdle();
+    }
+}
+
 int send_rx(uint8_t *buffer) {
     uint8_t result;
+    unsigned long start;
     nrf24_send(buffer);
-    while (!nrf24_isSending());
+    start = ClockMs();
+    while (nrf24_isSending() && !ClockExpired(start, NRF_TX_TIMEOUT));
 
     result = nrf24_lastMessageStatus();
     nrf24_powerUpRx();
     return result;
 }
 
+/* Derive the closing thresholds from the stored calibration */
+void cal_load() {
+    eeprom_read_block(&_cal, &_cal_eeprom, sizeof(_cal));
+    if (_cal.magic != CAL_MAGIC || _cal.contact <= _cal.baseline + CAL_TOUCH) {
+        _cal.magic = 0;
+        _force_closed = FORCE_CLOSED;
+        _slow_steps = TRAVEL_DEFAULT;
+        _close_extra = CLOSE_EXTRA;
+        return;
+    }
+    // Seated once the reading is half way up the learned contact rise
+    _force_closed = _cal.baseline + (_cal.contact - _cal.baseline) / 2;
+    _slow_steps = _cal.zone + CAL_MARGIN;
+    _close_extra = _cal.zone + 2 * CAL_MARGIN;
+}
+
+/* Load the learned travel, falling back to the compile time default */
+void travel_load() {
+    _travel = eeprom_read_word(&_travel_eeprom);
+    if (_travel == 0 || _travel > TRAVEL_MAX) {
+        _travel = TRAVEL_DEFAULT;
+    }
+}
+
+/* How far open the window is, 0 to 100 */
+uint8_t window_percent() {
+    return (uint32_t)_pos * 100 / _travel;
+}
+
+/* Wakes the stepper driver to move in dir */
+void motor_wake(uint8_t dir) {
+    PIN_WRITE(DIR_PIN, dir);
+    PIN_HIGH(SLEEP_PIN);
+    TRACE(MOTOR_START, dir);
+}
+
+/* Puts the stepper driver back to sleep once a move is over */
+void motor_sleep() {
+    PIN_LOW(SLEEP_PIN);
+    TRACE(MOTOR_STOP, window_percent());
+}
+
+void window_step(uint16_t wait) {
+    // Moves run for seconds, each step shows the tick isn't stuck
+    WatchdogProgress();
+    PIN_HIGH(STEP_PIN);
+    // Ends the latency trace of the command that started the move
+    LatencyMark(LATENCY_STEPPED);
+    LatencyEnd();
+    DelayUs(wait);
+    PIN_LOW(STEP_PIN);
+    DelayUs(wait);
+}
+
 void window_close() {
-    uint16_t wait = 1000;
-    uint16_t force = ADC;
+    uint16_t wait = _wait_start;
+    uint16_t wait_min = _cal.magic ? _close_wait_fast : _close_wait_safe;
+    uint16_t force = adc_read(FORCE_PIN);
     uint16_t close_count = 0;
-    if (force >= 100) {
+    if (force >= _force_closed) {
         _status = CLOSED;
-        _revs = 0;
-        _steps = 0;
+        _pos = 0;
         return;
     }
     _send_buffer[2] = CLOSING;
     send_rx(_send_buffer);
-    PORTC = SetBit(PORTC, DIR_PIN, CLOSE_DIR);
-    PORTC = SetBit(PORTC, SLEEP_PIN, 1);
-    while (force < 100 && !_no_force_sensor) {
-        if (nrf24_dataReady()) {
-            nrf24_getData(_rcv_buffer);
-            PORTC = SetBit(PORTC, SLEEP_PIN, 0);
-            _status = OPEN;
+    motor_wake(CLOSE_DIR);
+    while (force < _force_closed && !_no_force_sensor) {
+        // Any packet stops the motor and is dropped. Homing from main()
+        // isn't stopped, packets wait in the queue for tick_nrf.
+        radio_poll();
+        if (BootDone(BOOT_HOMED) && RING_POP(_rx_queue, &_rcv_packet)) {
+            motor_sleep();
+            _status = OPEN_PARTIAL;
             return;
         }
-        else if (!GetBit(PIND, 0) || !GetBit(PIND, 1)) {
-            PORTC = SetBit(PORTC, SLEEP_PIN, 0);
-            _status = OPEN;
+        else if (!PIN_READ(OPEN_PIN) || !PIN_READ(CLOSE_PIN)) {
+            motor_sleep();
+            _status = OPEN_PARTIAL;
             return;
         }
-        PORTC = SetBit(PORTC, STEP_PIN, 1);
-        therm_delay(us(wait));
-        PORTC = SetBit(PORTC, STEP_PIN, 0);
-        therm_delay(us(wait));
-        _steps--;
-        if (_steps == 0) {
-            _revs = _revs > 0 ? _revs - 1 : _revs;
-            _steps = STEPS_REV;
+        window_step(wait);
+        if (_pos > 0) {
+            _pos--;
         }
-        if (_revs == 0) {
+        else {
             close_count++;
-            if (close_count > 400) {
+            if (close_count > _close_extra) {
                 _no_force_sensor = 1;
                 break;
             }
         }
-        wait = wait > 400 ? wait - 1 : wait;
-        force = ADC;
+        force = adc_read(FORCE_PIN);
+        // Slow down in the learned contact zone, or as soon as the
+        // sensor starts to rise if the window is not where we think
+        if (_cal.magic && (_pos <= _slow_steps ||
+                    force > _cal.baseline + CAL_TOUCH)) {
+            wait = wait < _close_wait_slow ? _close_wait_slow : wait;
+        }
+        else {
+            wait = wait > wait_min ? wait - 1 : wait;
+        }
+    }
+    _status = CLOSED;
+    _pos = 0;
+    motor_sleep();
+    radio_active();
+}
+
+/*
+ * Homes the window against the seal, learning the force sensor on the
+ * way back in if it has no calibration: backs the window off, averages
+ * the idle reading, then closes slowly recording where the force starts
+ * to rise and where it levels off, and stores the result in EEPROM.
+ * Written as a coroutine with the task macros of scheduler.h so
+ * tick_boot can run it in the background: it yields every HOME_SLICE
+ * steps and is called again with what it returned until that is
+ * TASK_START. Ends with _status CLOSED, or OPEN_PARTIAL if a button
+ * stopped it, keeping any earlier calibration.
+ */
+int window_home_run(int state) {
+    static uint16_t steps;
+    static uint16_t backoff;
+    static uint16_t touch;
+    static uint16_t peak;
+    static uint16_t settle;
+    static uint8_t touched;
+    static uint8_t slice;
+    uint16_t force;
+    uint32_t sum = 0;
+    uint8_t i;
+
+    TASK_BEGIN(state);
+    slice = 0;
+    steps = 0;
+    _status = CLOSING;
+    motor_wake(CLOSE_DIR);
+    while (adc_read(FORCE_PIN) < _force_closed && !_no_force_sensor) {
+        if (!PIN_READ(OPEN_PIN) || !PIN_READ(CLOSE_PIN)) {
+            motor_sleep();
+            cal_load();
+            _status = OPEN_PARTIAL;
+            return TASK_START;
+        }
+        window_step(_close_wait_slow);
+        if (_pos > 0) {
+            _pos--;
+        }
+        else if (++steps > _close_extra) {
+            _no_force_sensor = 1;
+        }
+        if (++slice == HOME_SLICE) {
+            slice = 0;
+            TASK_YIELD();
+        }
+    }
+    motor_sleep();
+    _pos = 0;
+    if (_cal.magic || _no_force_sensor) {
+        cal_load();
+        _status = CLOSED;
+        radio_active();
+        return TASK_START;
+    }
+
+    motor_wake(OPEN_DIR);
+    for (backoff = 0; backoff < CAL_BACKOFF; backoff++) {
+        if (!PIN_READ(OPEN_PIN) || !PIN_READ(CLOSE_PIN)) {
+            motor_sleep();
+            cal_load();
+            _status = OPEN_PARTIAL;
+            return TASK_START;
+        }
+        if (!PIN_READ(OPEN_LIMIT_PIN)) {
+            break;
+        }
+        window_step(CAL_WAIT);
+        _pos++;
+        if (++slice == HOME_SLICE) {
+            slice = 0;
+            TASK_YIELD();
+        }
+    }
+    for (i = 0; i < CAL_SAMPLES; i++) {
+        DelayUs(CAL_WAIT);
+        sum += adc_read(FORCE_PIN);
+    }
+    _cal.baseline = sum / CAL_SAMPLES;
+    _cal.zone = 0;
+    peak = _cal.baseline;
+    touch = 0;
+    touched = 0;
+    settle = 0;
+
+    motor_wake(CLOSE_DIR);
+    for (steps = 0; steps < backoff + CLOSE_EXTRA; steps++) {
+        if (!PIN_READ(OPEN_PIN) || !PIN_READ(CLOSE_PIN)) {
+            break;
+        }
+        window_step(CAL_WAIT);
+        if (_pos > 0) {
+            _pos--;
+        }
+        force = adc_read(FORCE_PIN);
+        if (!touched) {
+            if (force > _cal.baseline + CAL_TOUCH) {
+                touched = 1;
+                touch = steps;
+                peak = force;
+            }
+        }
+        else if (force > peak) {
+            peak = force;
+            _cal.zone = steps - touch;
+            settle = 0;
+        }
+        else if (++settle >= CAL_SETTLE) {
+            break;
+        }
+        if (++slice == HOME_SLICE) {
+            slice = 0;
+            TASK_YIELD();
+        }
     }
+    motor_sleep();
+
+    _cal.contact = peak;
+    if (!touched || settle < CAL_SETTLE) {
+        // Stopped, or never saw the window seat: keep what was there
+        if (steps == backoff + CLOSE_EXTRA) {
+            _no_force_sensor = !touched;
+        }
+        cal_load();
+        _status = OPEN_PARTIAL;
+        return TASK_START;
+    }
+    _cal.magic = CAL_MAGIC;
+    eeprom_update_block(&_cal, &_cal_eeprom, sizeof(_cal));
+    cal_load();
     _status = CLOSED;
-    _revs = 0;
-    _steps = 0;
-    PORTC = SetBit(PORTC, SLEEP_PIN, 0);
+    _pos = 0;
+    radio_active();
+    TASK_END();
+}
+
+/* Relearn the force sensor in one go, see window_home_run() */
+void window_calibrate() {
+    int state;
+    _cal.magic = 0;
+    state = window_home_run(TASK_START);
+    while (state != TASK_START) {
+        state = window_home_run(state);
+    }
 }
 
 void window_open() {
-    uint16_t wait = 1000;
-    if (_revs == REV_OPEN)
+    uint16_t wait = _wait_start;
+    if (_pos >= _travel)
         return;
     _send_buffer[2] = OPENING;
     send_rx(_send_buffer);
-    PORTC = SetBit(PORTC, DIR_PIN, OPEN_DIR);
-    PORTC = SetBit(PORTC, SLEEP_PIN, 1);
-    while (_revs < REV_OPEN && !_no_force_sensor) {
-        if (nrf24_dataReady()) {
-            nrf24_getData(_rcv_buffer);
-            PORTC = SetBit(PORTC, SLEEP_PIN, 0);
-            _status = OPEN;
+    motor_wake(OPEN_DIR);
+    while (_pos < _travel && !_no_force_sensor) {
+        // Any packet stops the motor and is dropped
+        radio_poll();
+        if (RING_POP(_rx_queue, &_rcv_packet)) {
+            motor_sleep();
+            _status = OPEN_PARTIAL;
             return;
         }
-        else if (!GetBit(PIND, 0) || !GetBit(PIND, 1)) {
-            PORTC = SetBit(PORTC, SLEEP_PIN, 0);
-            _status = OPEN;
+        else if (!PIN_READ(OPEN_PIN) || !PIN_READ(CLOSE_PIN)) {
+            motor_sleep();
+            _status = OPEN_PARTIAL;
             return;
         }
-        PORTC = SetBit(PORTC, STEP_PIN, 1);
-        therm_delay(us(wait));
-        PORTC = SetBit(PORTC, STEP_PIN, 0);
-        therm_delay(us(wait));
-        _steps++;
-        if (_steps == STEPS_REV) {
-            _revs++;
-            _steps = 0;
+        else if (!PIN_READ(OPEN_LIMIT_PIN)) {
+            break;
+        }
+        window_step(wait);
+        _pos++;
+        // Mirror the acceleration ramp so the window coasts into the
+        // measured open end
+        if (_travel - _pos <= _wait_start - wait) {
+            wait = wait < _wait_start ? wait + 1 : wait;
+        }
+        else {
+            wait = wait > _open_wait_fast ? wait - 1 : wait;
         }
-        wait = wait > 300 ? wait - 1 : wait;
     }
     _status = OPEN;
-    PORTC = SetBit(PORTC, SLEEP_PIN, 0);
+    motor_sleep();
+    radio_active();
+}
+
+/*
+ * Learn the full travel of this window. Homes against the force sensor,
+ * then opens slowly until the open end switch closes or a button is
+ * pressed at the open end. The step count is stored in EEPROM.
+ */
+void window_learn_travel() {
+    uint16_t steps = 0;
+    window_close();
+    if (_status != CLOSED || _no_force_sensor) {
+        return;
+    }
+    motor_wake(OPEN_DIR);
+    while (steps < TRAVEL_MAX) {
+        if (!PIN_READ(OPEN_LIMIT_PIN) ||
+                !PIN_READ(OPEN_PIN) || !PIN_READ(CLOSE_PIN)) {
+            break;
+        }
+        window_step(CAL_WAIT);
+        steps++;
+    }
+    motor_sleep();
+    _pos = steps;
+    if (steps > 0 && steps < TRAVEL_MAX) {
+        _travel = steps;
+        eeprom_update_word(&_travel_eeprom, _travel);
+    }
+    _status = _pos >= _travel ? OPEN : OPEN_PARTIAL;
+}
+
+/* Close the window so we know what state it is in for sure, learning
+ * the force sensor first if it has never been calibrated */
+void window_home() {
+    if (_cal.magic) {
+        window_close();
+    }
+    else {
+        window_calibrate();
+    }
+}
+
+/* Saturates a statistics counter to fit a payload byte */
+uint8_t sat8(unsigned long value) {
+    return value > 0xFF ? 0xFF : value;
+}
+
+/*
+ * Sends why the window last reset, see watchdog.h: MCUSR after the
+ * reset, the task running at the latest watchdog reset, RESET_TAG | the
+ * watchdog resets, the task found late before it
+ */
+uint8_t send_reset() {
+    uint8_t buffer[4];
+    buffer[0] = watchdog_record.cause;
+    buffer[1] = watchdog_record.task;
+    buffer[2] = RESET_TAG | (watchdog_record.count > 0x0F ? 0x0F : watchdog_record.count);
+    buffer[3] = watchdog_record.late;
+    return send_rx(buffer);
 }
+
+/*
+ * Sends one packet per task with its scheduler statistics:
+ * longest tick in ms, overruns, STATS_TAG | task number, misses.
+ * The reset report follows.
+ */
+void send_stats() {
+    task_stats stats;
+    uint8_t i;
+    for (i = 0; i < TASKS_COUNT; i++) {
+        TaskStats(i, &stats);
+        _send_buffer[0] = sat8(stats.max / SCHED_CYCLES_MS);
+        _send_buffer[1] = sat8(stats.overruns);
+        _send_buffer[2] = STATS_TAG | i;
+        _send_buffer[3] = sat8(stats.misses);
+        send_rx(_send_buffer);
+    }
+    send_reset();
+}
+
 /* State machines */
 
 enum auto_states { AUTO_OFF, AUTO_ON };
@@ -168,18 +641,24 @@ int tick_auto(int state) {
         case AUTO_OFF:
             if (_auto) {
                 state = AUTO_ON;
+                TaskSetPeriod(TASK_tick_auto, AUTO_FAST);
             }
             break;
         case AUTO_ON:
             if (!_auto) {
                 state = AUTO_OFF;
+                TaskSetPeriod(TASK_tick_auto, AUTO_SLOW);
+            }
+            else if (_therm_fault || !BootDone(BOOT_HOMED)) {
+                // Nothing to go on until both sensors read again, and
+                // nothing to move until homing is over
             }
             else if (_status == CLOSED) {
                 if (_temp_in > _temp_max && _temp_out < _temp_max) {
                     window_open();
                 }
             }
-            else if (_status == OPEN) {
+            else if (_status == OPEN || _status == OPEN_PARTIAL) {
                 if (_temp_in < _temp_min) {
                     window_close();
                 }
@@ -194,22 +673,41 @@ int tick_auto(int state) {
     return state;
 }
 
-enum sensor_states { WAIT };
+enum sensor_states { WAIT, RELEASE };
 int tick_alert(int state) {
     static uint8_t val = 0;
     switch (state) {
         case WAIT:
-            if (!GetBit(PIND, 0)) {
+            // Holding both buttons relearns the force sensor and travel,
+            // once homing is over
+            if (!PIN_READ(OPEN_PIN) && !PIN_READ(CLOSE_PIN) && BootDone(BOOT_HOMED)) {
+                state = RELEASE;
+                break;
+            }
+            if (!PIN_READ(OPEN_PIN)) {
                 _no_force_sensor = 0;
             }
-            if (_no_force_sensor) {
-                PORTB = SetBit(PORTB, 2, val);
+            // A stack into its guard bytes is about to overwrite .bss
+            if (_no_force_sensor || _therm_fault || !StackOk()) {
+                PIN_WRITE(ALERT_PIN, val);
                 val = !val;
+                TaskSetPeriod(TASK_tick_alert, ALERT_FAST);
             }
             else {
-                PORTB = SetBit(PORTB, 2, 0);
+                PIN_LOW(ALERT_PIN);
+                TaskSetPeriod(TASK_tick_alert, ALERT_SLOW);
             }
             break;
+        case RELEASE:
+            // Buttons stop the motor, wait for both to be released
+            if (!PIN_READ(OPEN_PIN) || !PIN_READ(CLOSE_PIN)) {
+                break;
+            }
+            _no_force_sensor = 0;
+            window_calibrate();
+            window_learn_travel();
+            state = WAIT;
+            break;
         default:
             state = WAIT;
             break;
@@ -222,29 +720,44 @@ enum nrf_states { NRF_RCV, NRF_SEND, NRF_WAIT };
 int tick_nrf(int state) {
     switch (state) {
         case NRF_SEND:
-            if (nrf24_dataReady()) {
-                nrf24_getData(_rcv_buffer);
-                if (_rcv_buffer[0] == OPEN) {
+            radio_poll();
+            while (RING_POP(_rx_queue, &_rcv_packet)) {
+                BootMark(BOOT_COMMAND);
+                radio_active();
+                LatencyMark(LATENCY_DISPATCHED);
+                if (_rcv_packet.data[0] == OPEN) {
                     if (_auto) {
                         _auto = 0;
                     }
+                    else if (!BootDone(BOOT_HOMED)) {
+                        // Where the window is is unknown, open once homed
+                        _after_home = OPEN;
+                    }
                     else {
                         window_open();
                     }
                 }
-                else if (_rcv_buffer[0] == CLOSED) {
+                else if (_rcv_packet.data[0] == CLOSED) {
                     if (_auto) {
                         _auto = 0;
                     }
+                    else if (!BootDone(BOOT_HOMED)) {
+                        _after_home = CLOSED;
+                    }
                     else {
                         window_close();
                     }
                 }
-                else if (_rcv_buffer[0] == 3) {
+                else if (_rcv_packet.data[0] == CMD_AUTO) {
                     _auto = 1;
-                    _temp_max = _rcv_buffer[1];
-                    _temp_min = _rcv_buffer[2];
+                    _temp_max = _rcv_packet.data[1];
+                    _temp_min = _rcv_packet.data[2];
+                }
+                else if (_rcv_packet.data[0] == CMD_STATS) {
+                    send_stats();
                 }
+                // Whatever didn't move the motor isn't traced
+                LatencyCancel();
             }
             _send_buffer[0] = _temp_in;
             _send_buffer[1] = _temp_out;
@@ -256,6 +769,14 @@ int tick_nrf(int state) {
             }
             _send_buffer[3] = _auto;
             send_rx(_send_buffer);
+            BootMark(BOOT_READY);
+            // Until the remote has heard about an unexpected reset
+            if (_reset_report && send_reset() == NRF24_TRANSMISSON_OK) {
+                _reset_report = 0;
+            }
+            if (_fast_polls && --_fast_polls == 0) {
+                TaskSetPeriod(TASK_tick_nrf, NRF_SLOW);
+            }
             break;
         default:
             state = NRF_SEND;
@@ -264,66 +785,370 @@ int tick_nrf(int state) {
     return state;
 }
 
-enum temp_states { TEMP_INIT, TEMP_GET };
+/*
+ * Reads both sensors without blocking the other tasks. The 750 ms
+ * conversions run side by side while the task is suspended. A sensor
+ * that doesn't answer or finish within THERM_CONVERT_MS reads as
+ * TEMP_FAULT and sets its bit in _therm_fault, bit 1 indoors.
+ */
 int tick_temp(int state) {
-    switch (state) {
-        case TEMP_GET:
-            _temp_in = therm_read_temperature(1);
-            _temp_out = therm_read_temperature(0);
+    static unsigned int period;
+    static unsigned long start;
+    static uint8_t missing;
+    uint8_t fault;
+    TASK_BEGIN(state);
+    missing = therm_convert(1) ? 1 << 1 : 0;
+    missing |= therm_convert(0) ? 1 << 0 : 0;
+    start = ClockMs();
+    // The first reading is picked up as soon as it is done rather than
+    // a period later, see main()
+    if (!BootDone(BOOT_TEMPS)) {
+        period = TaskPeriodMs(TASK_tick_temp);
+        TaskSetPeriod(TASK_tick_temp, TEMP_FIRST_POLL);
+    }
+    TASK_SLEEP(750);
+    // A shorted bus never finishes
+    TASK_WAIT_UNTIL((therm_converted(1) && therm_converted(0)) ||
+            ClockExpired(start, THERM_CONVERT_MS));
+    fault = missing;
+    if (!therm_converted(1)) {
+        fault |= 1 << 1;
+    }
+    if (!therm_converted(0)) {
+        fault |= 1 << 0;
+    }
+    _temp_in = fault & (1 << 1) ? TEMP_FAULT : therm_read_result(1);
+    _temp_out = fault & (1 << 0) ? TEMP_FAULT : therm_read_result(0);
+    _therm_fault = fault;
+    if (!BootDone(BOOT_TEMPS)) {
+        TaskSetPeriod(TASK_tick_temp, period);
+        BootMark(BOOT_TEMPS);
+    }
+    TASK_END();
+}
+
+#ifdef BOOT_FAST
+/* Homes the window in the background: runs window_home_run() a slice
+ * on every tick while the other tasks go on taking commands and reading
+ * the sensors. A held button stops homing, which starts over once both
+ * are released. Once the seal has been reached it opens the window if
+ * an OPEN came in meanwhile and parks. */
+int tick_boot(int state) {
+    static int home;
+    TASK_BEGIN(state);
+    TaskSetPeriod(TASK_tick_boot, TASKS_GCD);
+    do {
+        TASK_WAIT_UNTIL(PIN_READ(OPEN_PIN) && PIN_READ(CLOSE_PIN));
+        home = window_home_run(TASK_START);
+        while (home != TASK_START) {
+            TASK_YIELD();
+            home = window_home_run(home);
+        }
+    } while (_status != CLOSED);
+    BootMark(BOOT_HOMED);
+    TaskSetPeriod(TASK_tick_boot, BOOT_PARKED);
+    if (_after_home == OPEN) {
+        window_open();
+    }
+    TASK_WAIT_UNTIL(0);
+    TASK_END();
+}
+#endif
+
+/* Console commands, see CONSOLE_COMMANDS */
+
+/* Per task: period, tick time min/avg/max in us, latest dispatch in ms,
+ * overruns and misses. Then the busiest tick before and after phasing
+ * and the UART's dropped bytes. */
+uint8_t console_stats(uint8_t argc, char **argv, uint8_t row) {
+    task_stats stats;
+    if (argc > 1 && !strcmp_P(argv[1], PSTR("clear"))) {
+        TasksStatsClear();
+        return CONSOLE_DONE;
+    }
+    if (row == 0) {
+        ConsolePutsP(PSTR("task period min avg max late overruns misses"));
+        ConsoleEnd();
+        return CONSOLE_MORE;
+    }
+    if (row == TASKS_COUNT + 1) {
+        // Most tasks released in one tick, see TasksPhases()
+        ConsolePutsP(PSTR("peak tick "));
+        ConsolePutU(tasksPeakAfter);
+        ConsolePutsP(PSTR(" tasks, "));
+        ConsolePutU(tasksPeakBefore);
+        ConsolePutsP(PSTR(" with the table phases"));
+        ConsoleEnd();
+        return CONSOLE_MORE;
+    }
+    if (row > TASKS_COUNT) {
+        ConsolePutsP(PSTR("uart dropped "));
+        ConsolePutU(uart_rx_dropped);
+        ConsoleEnd();
+        return CONSOLE_DONE;
+    }
+    TaskStats(row - 1, &stats);
+    ConsolePutU(row - 1);
+    ConsolePut(' ');
+    ConsolePutU(TaskPeriodMs(row - 1));
+    ConsolePut(' ');
+    ConsolePutU(stats.min / (F_CPU / 1000000));
+    ConsolePut(' ');
+    ConsolePutU(stats.avg / (F_CPU / 1000000));
+    ConsolePut(' ');
+    ConsolePutU(stats.max / (F_CPU / 1000000));
+    ConsolePut(' ');
+    ConsolePutU(stats.maxLate);
+    ConsolePut(' ');
+    ConsolePutU(stats.overruns);
+    ConsolePut(' ');
+    ConsolePutU(stats.misses);
+    ConsoleEnd();
+    return CONSOLE_MORE;
+}
+
+/* Per latency point in latency.h order: longest in us, then buckets */
+uint8_t console_lat(uint8_t argc, char **argv, uint8_t row) {
+    uint8_t b;
+    (void)argc; (void)argv;
+    if (row > LATENCY_TOTAL) {
+        return CONSOLE_DONE;
+    }
+    ConsolePutU(row);
+    ConsolePut(' ');
+    ConsolePutU(latency_max[row]);
+    for (b = 0; b < LATENCY_BUCKETS; b++) {
+        ConsolePut(' ');
+        ConsolePutU(latency_hist[row][b]);
+    }
+    ConsoleEnd();
+    return CONSOLE_MORE;
+}
+
+/* Lists the task periods, or sets one. Tasks that pick their own
+ * period fast or slow will change it again when they next switch. */
+uint8_t console_period(uint8_t argc, char **argv, uint8_t row) {
+    long task, ms;
+    if (argc == 3) {
+        if (!ConsoleNumber(argv[1], &task) || task < 0 || task >= TASKS_COUNT ||
+                !ConsoleNumber(argv[2], &ms) || ms <= 0 || ms > TASKS_PERIOD_MAX_MS ||
+                !TaskSetPeriod(task, ms)) {
+            ConsolePutsP(PSTR("needs a task number and a multiple of "));
+            ConsolePutU(TASKS_GCD);
+            ConsolePutsP(PSTR(" ms up to "));
+            ConsolePutU(TASKS_PERIOD_MAX_MS);
+            ConsoleEnd();
+        }
+        return CONSOLE_DONE;
+    }
+    if (row >= TASKS_COUNT) {
+        return CONSOLE_DONE;
+    }
+    ConsolePutU(row);
+    ConsolePut(' ');
+    ConsolePutU(TaskPeriodMs(row));
+    ConsoleEnd();
+    return CONSOLE_MORE;
+}
+
+/*
+ * Self-test, a line per check: the radio holds the configured channel,
+ * both temperature sensors answer a reset and finished their latest
+ * reading, the force sensor reads off the rails and the delays are on
+ * time, see DelayCheck(). The sensors are only reset between
+ * conversions.
+ */
+uint8_t console_test(uint8_t argc, char **argv, uint8_t row) {
+    uint8_t ok = 0;
+    uint8_t channel;
+    uint16_t force;
+    unsigned long worst;
+    delay_result delays[DELAY_CHECK_COUNT];
+    (void)argc; (void)argv;
+    switch (row) {
+        case 0:
+            nrf24_readRegister(RF_CH, &channel, 1);
+            ok = channel == NRF_CHANNEL;
+            ConsolePutsP(PSTR("radio channel "));
+            ConsolePutU(channel);
             break;
-        default:
-            state = TEMP_INIT;
+        case 1:
+        case 2:
+            if (tasks[TASK_tick_temp].state != TASK_START) {
+                return CONSOLE_WAIT;
+            }
+            // Sensor 1 is indoors, 0 outdoors
+            ok = !therm_reset(2 - row) && !(_therm_fault & (1 << (2 - row)));
+            ConsolePutsP(row == 1 ? PSTR("indoor sensor ") : PSTR("outdoor sensor "));
+            ConsolePutI(row == 1 ? _temp_in : _temp_out);
+            ConsolePutsP(PSTR(" F"));
             break;
+        case 3:
+            force = adc_read(FORCE_PIN);
+            ok = force > 0 && force < (1 << ADC_BITS) - 1;
+            ConsolePutsP(PSTR("force sensor "));
+            ConsolePutU(force);
+            ConsolePutsP(PSTR(", seated at "));
+            ConsolePutU(_force_closed);
+            break;
+        case 4:
+            worst = DelayCheck(delays);
+            ok = worst <= DELAY_CHECK_LIMIT;
+            ConsolePutsP(PSTR("delays worst "));
+            ConsolePutU(worst);
+            ConsolePutsP(PSTR(" cycles off"));
+            break;
+        default:
+            return CONSOLE_DONE;
+    }
+    ConsolePutsP(ok ? PSTR(": ok") : PSTR(": FAIL"));
+    ConsoleEnd();
+    return CONSOLE_MORE;
+}
+
+/* RAM use in bytes, see stack.h */
+uint8_t console_mem(uint8_t argc, char **argv, uint8_t row) {
+    (void)argc; (void)argv; (void)row;
+    ConsolePutsP(PSTR("static "));
+    ConsolePutU(StackStatic());
+    ConsolePutsP(PSTR(", stack max "));
+    ConsolePutU(StackMax());
+    ConsolePutsP(PSTR(", free "));
+    ConsolePutU(StackFree());
+    ConsolePutsP(StackOk() ? PSTR(", guard ok") : PSTR(", guard broken"));
+    ConsoleEnd();
+    return CONSOLE_DONE;
+}
+
+/* Sends the event trace as it drains, see trace.h */
+uint8_t console_trace(uint8_t argc, char **argv, uint8_t row) {
+    uint8_t n;
+    int b;
+    (void)argc; (void)argv;
+    if (row == 0) {
+        TraceDumpBegin();
+    }
+    for (n = 0; n < CONSOLE_ROOM; n++) {
+        b = TraceDumpByte();
+        if (b < 0) {
+            ConsoleEnd();
+            return CONSOLE_DONE;
+        }
+        ConsolePut(b);
+    }
+    return CONSOLE_MORE;
+}
+
+/* Start-up phases in ms since ClockOn(), see boot.h */
+uint8_t console_boot(uint8_t argc, char **argv, uint8_t row) {
+    (void)argc; (void)argv;
+    if (row >= BOOT_COUNT) {
+        return CONSOLE_DONE;
+    }
+    ConsolePutsP((const char *)pgm_read_ptr(&boot_names[row]));
+    ConsolePut(' ');
+    if (BootDone(row)) {
+        ConsolePutU(boot_us[row] / 1000);
+        ConsolePut('.');
+        ConsolePutU(boot_us[row] / 100 % 10);
+        ConsolePutsP(PSTR(" ms"));
+    }
+    else {
+        ConsolePut('-');
+    }
+    ConsoleEnd();
+    return CONSOLE_MORE;
+}
+
+/* Task number, - for none */
+void console_task(uint8_t i) {
+    if (i == WATCHDOG_NONE) {
+        ConsolePut('-');
+    }
+    else {
+        ConsolePutU(i);
+    }
+}
+
+/* Reset cause, then the latest watchdog reset, see watchdog.h */
+uint8_t console_wdt(uint8_t argc, char **argv, uint8_t row) {
+    (void)argc; (void)argv;
+    if (row == 0) {
+        ConsolePutsP(PSTR("reset by"));
+        if (watchdog_record.cause & (1 << WDRF)) {
+            ConsolePutsP(PSTR(" watchdog"));
+        }
+        if (watchdog_record.cause & (1 << BORF)) {
+            ConsolePutsP(PSTR(" brown-out"));
+        }
+        if (watchdog_record.cause & (1 << EXTRF)) {
+            ConsolePutsP(PSTR(" reset pin"));
+        }
+        if (watchdog_record.cause & (1 << PORF)) {
+            ConsolePutsP(PSTR(" power on"));
+        }
+        ConsoleEnd();
+        return CONSOLE_MORE;
     }
+    ConsolePutsP(PSTR("watchdog resets "));
+    ConsolePutU(watchdog_record.count);
+    ConsolePutsP(PSTR(", latest in task "));
+    console_task(watchdog_record.task);
+    ConsolePutsP(PSTR(" with task "));
+    console_task(watchdog_record.late);
+    ConsolePutsP(PSTR(" late"));
+    ConsoleEnd();
+    return CONSOLE_DONE;
+}
+
+int tick_console(int state) {
+    ConsoleTick();
     return state;
 }
 
+TASKS_DEFINE();
+TRACE_DEFINE();
+
 int main() {
     DDRD = 0x00; PORTD = 0xFF;
     DDRC = 0xFF; PORTC = 0x00;
     DDRB = 0xFF; PORTB = 0x00;
+    ClockOn();
+    UartInit();
     adc_init();
     nrf24_init();
-    nrf24_config(6, 4);
+    nrf24_config(NRF_CHANNEL, 4);
     nrf24_tx_address(_tx_address);
     nrf24_rx_address(_rx_address);
+    BootMark(BOOT_RADIO);
 
     // Put motor to sleep on startup
-    PORTC = SetBit(PORTC, SLEEP_PIN, 0);
-    // Close  window so we know what state it is in for sure
-    window_close();
-
+    PIN_LOW(SLEEP_PIN);
+    cal_load();
+    travel_load();
+    // Where the window is is unknown until it has been homed, so the
+    // homing close allows for the full travel
+    _pos = _travel;
+    // Homing and the first temperature readings take seconds. With
+    // BOOT_FAST they are left to tick_boot and tick_temp so the radio
+    // answers from the first tick, the first status going out with the
+    // temperatures still 0.
+#ifndef BOOT_FAST
+    // A held button stops homing, keep at it until the seal is reached
+    do {
+        window_home();
+    } while (_status != CLOSED);
+    BootMark(BOOT_HOMED);
     _temp_in = therm_read_temperature(1);
     _temp_out = therm_read_temperature(0);
-
-    /* define tasks */
-    tasksNum = 4; // declare number of tasks
-    task tsks[4]; // initialize the task array
-    tasks = tsks; // set the task array
-
-    uint8_t i = 0;
-    tasks[i].state = TEMP_GET;
-    tasks[i].period = 3000;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_temp;
-    i++;
-    tasks[i].state = NRF_SEND;
-    tasks[i].period = 100;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_nrf;
-    i++;
-    tasks[i].state = WAIT;
-    tasks[i].period = 100;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_alert;
-    i++;
-    tasks[i].state = AUTO_OFF;
-    tasks[i].period = 100;
-    tasks[i].elapsedTime = tasks[i].period;
-    tasks[i].TickFct = &tick_auto;
-
-    TimerSet(100);
+    BootMark(BOOT_TEMPS);
+#endif
+    BootMark(BOOT_SCHEDULER);
     TimerOn();
+    // A watchdog or brown-out reset is news to whoever holds the remote
+    _reset_report = watchdog_record.cause & ((1 << WDRF) | (1 << BORF));
 
-    while(1) {}
+    while(1) {
+        TasksDispatch();
+    }
 }
@@ -12,6 +12,9 @@
 * -----------------------------------------------------------------------------
 */
 #include "nrf24.h"
+#include "nrf_pins.h"
+#include "bench.h"
+#include "trace.h"
 
 uint8_t payload_len;
 
@@ -139,6 +142,8 @@ void nrf24_getData(uint8_t* data)
 
     /* Reset status register */
     nrf24_configRegister(STATUS,(1<<RX_DR));   
+
+    TRACE(NRF_RECEIVE, data[0]);
 }
 
 /* Returns the number of retransmissions occured for the last message */
@@ -154,6 +159,8 @@ uint8_t nrf24_retransmissionCount()
 // amount of bytes as configured as payload on the receiver.
 void nrf24_send(uint8_t* value) 
 {    
+    TRACE(NRF_SEND, value[0]);
+
     /* Go to Standby-I first */
     nrf24_ce_digitalWrite(LOW);
      
@@ -270,6 +277,7 @@ uint8_t spi_transfer(uint8_t tx)
     uint8_t i = 0;
     uint8_t rx = 0;    
 
+    BENCH_BEGIN(SPI);
     nrf24_sck_digitalWrite(LOW);
 
     for(i=0;i<8;i++)
@@ -296,6 +304,7 @@ uint8_t spi_transfer(uint8_t tx)
 
     }
 
+    BENCH_END(SPI);
     return rx;
 }
 
@@ -0,0 +1,13 @@
+/*
+* Radio pins of the window on PORTA, as pin.h descriptors for nrf24.h
+*/
+#ifndef NRF_PINS_H
+#define NRF_PINS_H
+
+#define NRF_CE   A, 1
+#define NRF_CSN  A, 2
+#define NRF_SCK  A, 3
+#define NRF_MOSI A, 4
+#define NRF_MISO A, 5
+
+#endif